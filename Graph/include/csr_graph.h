@@ -0,0 +1,193 @@
+#ifndef CSR_GRAPH_H
+#define CSR_GRAPH_H
+
+#include "unordered_map"
+#include "vector"
+#include "memory"
+#include "algorithm"
+#include "utility"
+#include "iterator.h"
+
+namespace au {
+
+// order of the out-edges of one vertex inside a csr_graph
+enum class edge_order { base, by_data };
+
+// Immutable graph in compressed sparse row form: vertices get dense ids
+// [0, n), the out-edges of vertex i are edges_[offsets_[i], offsets_[i + 1]).
+// Built by materialize() (see materialize.h), exposes the same read-only
+// interface as graph / filtered_graph, so find_shortest_path works on it.
+template<class vertex_type, class edge_type>
+class csr_graph {
+public:
+    typedef vertex_type                         vertex_data;
+    typedef edge_type                           edge_data;
+    typedef std::vector<vertex_data>            vertexies;
+
+    using vertex_const_iterator_type = typename vertexies::const_iterator;
+
+    using vertex_const_iterator      = iterator<vertex_const_iterator_type,
+                                vertex_policy<vertex_const_iterator_type>,
+                                base<vertex_const_iterator_type>>;
+
+    using vertex_iterator            = vertex_const_iterator;
+
+    struct edge {
+        typedef edge_data value_type;
+
+        edge() = default;
+
+        edge(size_t from, size_t to, edge_data const& data,
+             vertexies const* vert) :
+                vertexies_prt(vert), from_(from), to_(to), data_(data) { }
+
+        vertex_const_iterator from() const {
+            return vertex_const_iterator(vertexies_prt->cbegin() + from_);
+        }
+
+        vertex_const_iterator to() const {
+            return vertex_const_iterator(vertexies_prt->cbegin() + to_);
+        }
+
+        size_t from_id() const {
+            return from_;
+        }
+
+        size_t to_id() const {
+            return to_;
+        }
+
+        const value_type& data() const {
+            return data_;
+        }
+    private:
+        vertexies const*    vertexies_prt;
+        size_t              from_;
+        size_t              to_;
+        edge_data           data_;
+    };
+
+    typedef std::vector<edge>                           edge_set;
+    typedef std::vector<size_t>                         offsets;
+    typedef std::unordered_map<vertex_data, size_t>     vertex_ids;
+
+    using edge_const_iterator_type = typename edge_set::const_iterator;
+
+    using edge_const_iterator      =          iterator<edge_const_iterator_type,
+                                const_edge_policy<edge_const_iterator_type,
+                                            vertex_const_iterator>,
+                                base<edge_const_iterator_type>>;
+
+    using edge_iterator            = edge_const_iterator;
+
+    csr_graph() : vertexies_(std::make_shared<vertexies>()), offsets_(1, 0),
+                  order_(edge_order::base) { }
+
+    // vertices are taken in id order, ids maps every vertex to its index,
+    // offsets.size() == vertices.size() + 1, edges must point into *vertices
+    // and be sorted by data inside every vertex if order is by_data
+    csr_graph(std::shared_ptr<vertexies> vertices, vertex_ids && ids,
+              offsets && offset, edge_set && edges,
+              edge_order order = edge_order::base) :
+            vertexies_(std::move(vertices)), offsets_(std::move(offset)),
+            edges_(std::move(edges)), ids_(std::move(ids)), order_(order) { }
+
+    size_t vertex_count() const {
+        return vertexies_->size();
+    }
+
+    size_t edge_count() const {
+        return edges_.size();
+    }
+
+    edge_order order() const {
+        return order_;
+    }
+
+    // edges of from with low <= data <= high, found by binary search;
+    // requires order() == edge_order::by_data
+    std::pair<edge_const_iterator, edge_const_iterator>
+    edge_range(vertex_const_iterator const& from, edge_data const& low,
+               edge_data const& high) const {
+        if (from == vertex_end()) {
+            return {edge_const_iterator(), edge_const_iterator()};
+        }
+        size_t id = vertex_id(from);
+        auto begin = edges_.cbegin() + offsets_[id];
+        auto end = edges_.cbegin() + offsets_[id + 1];
+        begin = std::lower_bound(begin, end, low,
+                                 [](edge const& item, edge_data const& value) {
+                                     return item.data() < value;
+                                 });
+        end = std::upper_bound(begin, end, high,
+                               [](edge_data const& value, edge const& item) {
+                                   return value < item.data();
+                               });
+        return {edge_const_iterator(begin, end), edge_const_iterator(end, end)};
+    }
+
+    size_t vertex_id(vertex_const_iterator const& iter) const {
+        return static_cast<size_t>(iter.iter_ - vertexies_->cbegin());
+    }
+
+    vertex_const_iterator find_vertex(vertex_data const& data) const {
+        auto iter = ids_.find(data);
+        if (iter == ids_.end()) {
+            return vertex_end();
+        }
+        return vertex_const_iterator(vertexies_->cbegin() + iter->second,
+                                     vertexies_->cend());
+    }
+
+    edge_const_iterator find_edge(vertex_const_iterator const& from,
+                                  vertex_const_iterator const& to) const {
+        if (from == vertex_end() || to == vertex_end()) {
+            return edge_const_iterator();
+        }
+        auto end = edge_end(from);
+        for (auto iter = edge_begin(from); iter != end; ++iter) {
+            if (*iter.to() == *to) {
+                return iter;
+            }
+        }
+        return end;
+    }
+
+    vertex_const_iterator vertex_begin() const {
+        return vertex_const_iterator(vertexies_->cbegin(), vertexies_->cend());
+    }
+
+    vertex_const_iterator vertex_end() const {
+        return vertex_const_iterator(vertexies_->cend(), vertexies_->cend());
+    }
+
+    edge_const_iterator edge_begin(vertex_const_iterator const& from) const {
+        if (from == vertex_end()) {
+            return edge_const_iterator();
+        }
+        size_t id = vertex_id(from);
+        return edge_const_iterator(edges_.cbegin() + offsets_[id],
+                                   edges_.cbegin() + offsets_[id + 1]);
+    }
+
+    edge_const_iterator edge_end(vertex_const_iterator const& from) const {
+        if (from == vertex_end()) {
+            return edge_const_iterator();
+        }
+        size_t id = vertex_id(from);
+        return edge_const_iterator(edges_.cbegin() + offsets_[id + 1],
+                                   edges_.cbegin() + offsets_[id + 1]);
+    }
+
+private:
+    std::shared_ptr<vertexies>                  vertexies_;
+    offsets                                     offsets_;
+    edge_set                                    edges_;
+    vertex_ids                                  ids_;
+    edge_order                                  order_;
+
+}; // class csr_graph
+}
+// namespace au
+
+#endif // CSR_GRAPH_H
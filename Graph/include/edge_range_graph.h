@@ -0,0 +1,88 @@
+#ifndef EDGE_RANGE_GRAPH_H
+#define EDGE_RANGE_GRAPH_H
+
+#include "stdexcept"
+#include "csr_graph.h"
+#include "predicates.h"
+
+namespace au {
+
+// View of a csr_graph sorted by edge data (edge_order::by_data) that keeps
+// only the edges with low <= data <= high. The edges of a vertex are found
+// by binary search, the edges out of range are never visited.
+// Exposes the read-only graph interface (works with find_shortest_path).
+template<class csr>
+class edge_range_graph {
+public:
+    typedef typename csr::vertex_data                   vertex_data;
+    typedef typename csr::edge_data                     edge_data;
+    typedef typename csr::vertex_iterator               vertex_iterator;
+    typedef typename csr::vertex_const_iterator         vertex_const_iterator;
+    typedef typename csr::edge_iterator                 edge_iterator;
+    typedef typename csr::edge_const_iterator           edge_const_iterator;
+
+    edge_range_graph(csr const& g, edge_data const& low, edge_data const& high) :
+            graph_(g), low_(low), high_(high) {
+        if (graph_.order() != edge_order::by_data) {
+            throw std::logic_error("edge_range_graph: edges are not sorted by data");
+        }
+    }
+
+    vertex_const_iterator find_vertex(vertex_data const& data) const {
+        return graph_.find_vertex(data);
+    }
+
+    edge_const_iterator find_edge(vertex_const_iterator const& from,
+                                  vertex_const_iterator const& to) const {
+        if (from == vertex_end() || to == vertex_end()) {
+            return edge_const_iterator();
+        }
+        auto range = graph_.edge_range(from, low_, high_);
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            if (*iter.to() == *to) {
+                return iter;
+            }
+        }
+        return range.second;
+    }
+
+    vertex_const_iterator vertex_begin() const {
+        return graph_.vertex_begin();
+    }
+
+    vertex_const_iterator vertex_end() const {
+        return graph_.vertex_end();
+    }
+
+    edge_const_iterator edge_begin(vertex_const_iterator const& from) const {
+        return graph_.edge_range(from, low_, high_).first;
+    }
+
+    edge_const_iterator edge_end(vertex_const_iterator const& from) const {
+        return graph_.edge_range(from, low_, high_).second;
+    }
+
+private:
+    csr         const&  graph_;
+    edge_data           low_;
+    edge_data           high_;
+
+}; // class edge_range_graph
+
+template<class vertex_type, class edge_type>
+edge_range_graph<csr_graph<vertex_type, edge_type>>
+restrict_edges(csr_graph<vertex_type, edge_type> const& g,
+               range_predicate<edge_type> const& range) {
+    return edge_range_graph<csr_graph<vertex_type, edge_type>>(g, range.low(),
+                                                               range.high());
+}
+
+// The view refers to the csr_graph: it must not be built over a temporary.
+template<class vertex_type, class edge_type>
+edge_range_graph<csr_graph<vertex_type, edge_type>>
+restrict_edges(csr_graph<vertex_type, edge_type>&& g,
+               range_predicate<edge_type> const& range) = delete;
+
+} // namespace au
+
+#endif // EDGE_RANGE_GRAPH_H
@@ -18,19 +18,19 @@ public:
 
     class vertex_filter_function {
     public:
-        vertex_filter_function(vertex_function const &filter) : filter_(filter) { }
+        vertex_filter_function(vertex_filter const &filter) : filter_(filter) { }
 
         bool operator()(vertex_const_iterator_graph const & iter) const {
             return filter_(*iter);
         }
     private:
-        vertex_function filter_;
+        vertex_filter filter_;
     };
 
     class edge_filter_function {
     public:
-        edge_filter_function(edge_function const &filter,
-                             vertex_function const &filter_vertex)
+        edge_filter_function(edge_filter const &filter,
+                             vertex_filter const &filter_vertex)
             : filter_(filter), filter_vertex_(filter_vertex) { }
 
         bool operator()(edge_const_iterator_type const & iter) const {
@@ -38,29 +38,53 @@ public:
                     && filter_vertex_(*iter.to());
         }
     private:
-        edge_function filter_;
-        vertex_function filter_vertex_;
+        edge_filter filter_;
+        vertex_filter filter_vertex_;
     };
 
+    // iterators share the filter functions of the filtered_graph, so
+    // incrementing one is a direct (inlinable) call of the predicates
     using vertex_iterator       = iterator<vertex_const_iterator_graph ,
                                     vertex_policy<vertex_const_iterator_graph>,
-                                    base<vertex_const_iterator_graph>>;
+                                    base<vertex_const_iterator_graph>,
+                                    filter_ref<vertex_filter_function>>;
 
     using edge_iterator         = iterator<edge_const_iterator_type,
                                     filter_policy<edge_const_iterator_type,
                                             vertex_const_iterator_graph>,
-                                    base<edge_const_iterator_type>>;
+                                    base<edge_const_iterator_type>,
+                                    filter_ref<edge_filter_function>>;
     using edge_const_iterator   = edge_iterator;
     using vertex_const_iterator = vertex_iterator;
 
-    filtered_graph(graph const& g) : graph_(g) {}
+    filtered_graph(graph const& g) : filtered_graph(g, vertex_filter(),
+                                                    edge_filter()) {}
 
-    filtered_graph(graph const& g, vertex_filter const &filter_vertex,
-                   edge_filter const & filter_edge) :
-        graph_(g), vertex_filter_(filter_vertex),
-        vertex_filter_function_(vertex_filter_),
-        edge_filter_(filter_edge),
-        edge_filter_function_(edge_filter_, vertex_filter_)  { }
+    filtered_graph(graph const& g, vertex_filter filter_vertex,
+                   edge_filter filter_edge) :
+        graph_(g), vertex_filter_(std::move(filter_vertex)),
+        vertex_filter_function_(std::make_shared<vertex_filter_function const>(
+                                    vertex_filter_)),
+        edge_filter_(std::move(filter_edge)),
+        edge_filter_function_(std::make_shared<edge_filter_function const>(
+                                  edge_filter_, vertex_filter_))  { }
+
+    filtered_graph(filtered_graph const& other) :
+        filtered_graph(other.graph_, other.vertex_filter_, other.edge_filter_) { }
+
+    filtered_graph& operator=(filtered_graph const&) = delete;
+
+    graph const& base_graph() const {
+        return graph_;
+    }
+
+    vertex_filter const& vertex_predicate() const {
+        return vertex_filter_;
+    }
+
+    edge_filter const& edge_predicate() const {
+        return edge_filter_;
+    }
 
     vertex_iterator find_vertex(vertex_data const& data) const {
         if (!vertex_filter_(data)) {
@@ -129,11 +153,11 @@ public:
                              edge_filter_function_);
     }
 private:
-    graph               const&  graph_;
-    vertex_filter               vertex_filter_;
-    vertex_filter_function      vertex_filter_function_;
-    edge_filter                 edge_filter_;
-    edge_filter_function        edge_filter_function_;
+    graph                           const&          graph_;
+    vertex_filter                                   vertex_filter_;
+    std::shared_ptr<vertex_filter_function const>   vertex_filter_function_;
+    edge_filter                                     edge_filter_;
+    std::shared_ptr<edge_filter_function const>     edge_filter_function_;
 
 }; // class filtere_graph
 
@@ -0,0 +1,133 @@
+#ifndef FILTERED_VIEW_H
+#define FILTERED_VIEW_H
+
+#include "graph.h"
+
+namespace au {
+
+// Standing filtered copy of a graph: the surviving vertices and edges are
+// stored in a graph of their own, which is kept up to date by applying the
+// change notifications of the base graph instead of being rebuilt.
+// Exposes the read-only graph interface (works with find_shortest_path).
+template<class graph, typename vertex_filter, typename edge_filter>
+class filtered_view {
+public:
+    typedef typename graph::vertex_data                  vertex_data;
+    typedef typename graph::edge_data                    edge_data;
+    typedef typename graph::vertex_const_iterator        vertex_iterator;
+    typedef typename graph::vertex_const_iterator        vertex_const_iterator;
+    typedef typename graph::edge_const_iterator          edge_iterator;
+    typedef typename graph::edge_const_iterator          edge_const_iterator;
+    typedef typename graph::change                       change;
+    typedef typename graph::change_type                  change_type;
+
+    filtered_view(graph& g, vertex_filter filter_vertex, edge_filter filter_edge) :
+            graph_(g), vertex_filter_(std::move(filter_vertex)),
+            edge_filter_(std::move(filter_edge)) {
+        for (auto vertex = graph_.vertex_begin(); vertex != graph_.vertex_end();
+             ++vertex) {
+            if (vertex_filter_(*vertex)) {
+                view_.add_vertex(*vertex);
+            }
+        }
+        for (auto vertex = view_.vertex_begin(); vertex != view_.vertex_end();
+             ++vertex) {
+            auto from = graph_.find_vertex(*vertex);
+            for (auto edge = graph_.edge_begin(from); edge != graph_.edge_end(from);
+                 ++edge) {
+                add_edge(*edge.from(), *edge.to(), *edge);
+            }
+        }
+        subscription_ = graph_.subscribe([this](change const& event) {
+            apply(event);
+        });
+    }
+
+    filtered_view(filtered_view const&) = delete;
+    filtered_view& operator=(filtered_view const&) = delete;
+
+    ~filtered_view() {
+        graph_.unsubscribe(subscription_);
+    }
+
+    vertex_const_iterator find_vertex(vertex_data const& data) const {
+        return view_.find_vertex(data);
+    }
+
+    edge_const_iterator find_edge(vertex_const_iterator const& from,
+                                  vertex_const_iterator const& to) const {
+        return view_.find_edge(from, to);
+    }
+
+    vertex_const_iterator vertex_begin() const {
+        return view_.vertex_begin();
+    }
+
+    vertex_const_iterator vertex_end() const {
+        return view_.vertex_end();
+    }
+
+    edge_const_iterator edge_begin(vertex_const_iterator const& from) const {
+        return view_.edge_begin(from);
+    }
+
+    edge_const_iterator edge_end(vertex_const_iterator const& from) const {
+        return view_.edge_end(from);
+    }
+
+private:
+    void apply(change const& event) {
+        switch (event.type) {
+        case change_type::add_vertex:
+            if (vertex_filter_(event.from)) {
+                view_.add_vertex(event.from);
+            }
+            break;
+        case change_type::add_edge:
+            add_edge(event.from, event.to, event.data);
+            break;
+        case change_type::remove_edge: {
+            auto from = view_.find_vertex(event.from);
+            auto to = view_.find_vertex(event.to);
+            if (from != view_.vertex_end() && to != view_.vertex_end()) {
+                auto edge = view_.find_edge(from, to);
+                if (edge != view_.edge_end(from)) {
+                    view_.remove_edge(edge);
+                }
+            }
+            break;
+        }
+        case change_type::remove_vertex: {
+            // incident edges were already reported (and removed) one by
+            // one, so the vertex is isolated here
+            auto vertex = view_.find_vertex(event.from);
+            if (vertex != view_.vertex_end()) {
+                view_.remove_isolated_vertex(vertex);
+            }
+            break;
+        }
+        }
+    }
+
+    void add_edge(vertex_data const& from, vertex_data const& to,
+                  edge_data const& data) {
+        if (!edge_filter_(data)) {
+            return;
+        }
+        auto from_iter = view_.find_vertex(from);
+        auto to_iter = view_.find_vertex(to);
+        if (from_iter != view_.vertex_end() && to_iter != view_.vertex_end()) {
+            view_.add_edge(from_iter, to_iter, data);
+        }
+    }
+
+    graph&                      graph_;
+    vertex_filter               vertex_filter_;
+    edge_filter                 edge_filter_;
+    graph                       view_;
+    size_t                      subscription_;
+
+}; // class filtered_view
+
+} // namespace au
+#endif // FILTERED_VIEW_H
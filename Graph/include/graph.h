@@ -4,8 +4,11 @@
 #include "unordered_set"
 #include "unordered_map"
 #include "vector"
+#include "algorithm"
 #include "iterator.h"
 #include "memory"
+#include "functional"
+#include "cassert"
 
 namespace au {
 
@@ -96,14 +99,107 @@ public:
                                 base<edge_const_iterator_type>>;
 
 
+    enum class change_type { add_vertex, remove_vertex, add_edge, remove_edge };
+
+    // for vertex changes only from is set
+    struct change {
+        change_type     type;
+        vertex_data     from;
+        vertex_data     to;
+        edge_data       data;
+    };
+
+    typedef std::function<void(change const&)>  listener;
+
+    // Listeners are called synchronously from the mutating call, after the
+    // graph is updated. remove_vertex reports every removed edge before the
+    // vertex itself. Edge data changed through edge_iterator is not reported.
+    // Listeners belong to the graph object: copies start without listeners.
+    // A listener may subscribe and unsubscribe (itself too) from its call:
+    // removals are deferred until the notification is over, and listeners
+    // added meanwhile are called from the next change on.
+    class listener_list {
+    public:
+        listener_list() = default;
+        listener_list(listener_list const&) { }
+        listener_list& operator=(listener_list const&) {
+            return *this;
+        }
+
+        size_t add(listener const& func) {
+            listeners_.push_back({++last_id_, std::make_shared<listener>(func)});
+            return last_id_;
+        }
+
+        void remove(size_t id) {
+            for (auto& item : listeners_) {
+                if (item.first == id) {
+                    item.second.reset();
+                }
+            }
+            if (depth_ == 0) {
+                compact();
+            }
+        }
+
+        bool empty() const {
+            return listeners_.empty();
+        }
+
+        void notify(change const& event) const {
+            struct scope {
+                explicit scope(listener_list const& owner) : owner_(owner) {
+                    ++owner_.depth_;
+                }
+                ~scope() {
+                    if (--owner_.depth_ == 0) {
+                        owner_.compact();
+                    }
+                }
+                listener_list const& owner_;
+            } guard(*this);
+            size_t count = listeners_.size();
+            for (size_t i = 0; i < count; ++i) {
+                // kept alive even if the listener removes itself
+                std::shared_ptr<listener> func = listeners_[i].second;
+                if (func) {
+                    (*func)(event);
+                }
+            }
+        }
+    private:
+        typedef std::pair<size_t, std::shared_ptr<listener>> entry;
+
+        void compact() const {
+            listeners_.erase(std::remove_if(listeners_.begin(), listeners_.end(),
+                                            [](entry const& item) {
+                                                return !item.second;
+                                            }),
+                             listeners_.end());
+        }
+
+        mutable std::vector<entry>  listeners_;
+        mutable unsigned            depth_ = 0;
+        size_t                      last_id_ = 0;
+    };
+
     graph() {
         vertexies_ = std::make_shared<vertexies>();
     }
 
+    size_t subscribe(listener const& func) {
+        return listeners_.add(func);
+    }
+
+    void unsubscribe(size_t id) {
+        listeners_.remove(id);
+    }
+
 
     vertex_iterator add_vertex(vertex_data const &data) {
         auto pair_iter = vertexies_->insert (data);
         if (pair_iter.second){
+            notify({change_type::add_vertex, data, vertex_data(), edge_data()});
             return vertex_iterator(pair_iter.first, vertexies_->end ());
         }
         return vertex_iterator(vertexies_->end (), vertexies_->end ());
@@ -117,20 +213,22 @@ public:
             edges_[*from];
         }
         iter = edges_.find (*from);
-        iter->second.insert({*from, *to, data, vertexies_});
+        if (iter->second.insert({*from, *to, data, vertexies_}).second) {
+            notify({change_type::add_edge, *from, *to, data});
+        }
         return edge_iterator(edges_[*from].begin(), edges_[*from].end());
     }
 
     void remove_vertex(vertex_iterator const  &iter) {
         auto value = *iter;
-        std::unordered_map<vertex_data,edge> save;
+        std::vector<std::pair<vertex_data, edge>> save;
         for (auto edges_begin = edges_.begin (); edges_begin != edges_.end ();
              edges_begin++) {
             for (auto item = edges_begin->second.begin();
                  item != edges_begin->second.end(); item++) {
                 if(*item->to() == value ||
                         *item->from() == value) {
-                    save.insert ({edges_begin->first, *item});
+                    save.push_back ({edges_begin->first, *item});
                 }
             }
         }
@@ -139,6 +237,8 @@ public:
             if (edges_.find (item.first) != edges_.end()) {
                 if (edges_[item.first].find(item.second) != edges_[item.first].end()) {
                     edges_[item.first].erase(item.second);
+                    notify({change_type::remove_edge, *item.second.from(),
+                            *item.second.to(), item.second.data()});
                 }
             }
         }
@@ -146,6 +246,7 @@ public:
         auto it = vertexies_->find (value) ;
         if ( it != vertexies_->end ()) {
             vertexies_->erase (it);
+            notify({change_type::remove_vertex, value, vertex_data(), edge_data()});
         }
     }
 
@@ -156,8 +257,11 @@ public:
         auto iter_from = vertexies_->find (from);
         if (iter_from != vertexies_->end () && iter_to != vertexies_->end()) {
             edge edge_(from,to, vertexies_);
-            if (edges_[from].find(edge_) != edges_[from].end()) {
-                edges_[from].erase(edge_);
+            auto found = edges_[from].find(edge_);
+            if (found != edges_[from].end()) {
+                edge_data data = found->data();
+                edges_[from].erase(found);
+                notify({change_type::remove_edge, from, to, data});
             }
         }
     }
@@ -233,8 +337,36 @@ public:
     }
 
 private:
+    // filtered_view receives the removal of every incident edge before the
+    // removal of a vertex, so it knows the vertex to be isolated
+    template<class, typename, typename>
+    friend class filtered_view;
+
+    // Removes a vertex no edge enters or leaves: only the vertex is erased,
+    // without the scan over all edges of remove_vertex.
+    void remove_isolated_vertex(vertex_iterator const &iter) {
+        auto value = *iter;
+        auto out = edges_.find(value);
+        assert(out == edges_.end() || out->second.empty());
+        if (out != edges_.end()) {
+            edges_.erase(out);
+        }
+        auto it = vertexies_->find (value);
+        if (it != vertexies_->end ()) {
+            vertexies_->erase (it);
+            notify({change_type::remove_vertex, value, vertex_data(), edge_data()});
+        }
+    }
+
+    void notify(change const& event) const {
+        if (!listeners_.empty()) {
+            listeners_.notify(event);
+        }
+    }
+
     std::shared_ptr<vertexies>  vertexies_;
     edges                       edges_;
+    listener_list               listeners_;
 
 }; // class graph
 }
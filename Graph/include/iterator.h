@@ -2,6 +2,7 @@
 #define ITERATOR_H
 
 #include "iterator"
+#include "memory"
 
 template<class iter>
 class base {
@@ -117,6 +118,25 @@ struct filter_true {
     }
 };
 
+// calls a filter shared by every iterator made from one filtered_graph: an
+// iterator keeps the filter alive, so it stays valid after the graph object
+// that created it is gone (only the base graph has to outlive it). Copying
+// shares the filter instead of copying it, and a default constructed
+// filter_ref (of a default constructed iterator) lets every value through.
+template<class filter>
+class filter_ref {
+public:
+    filter_ref() = default;
+    filter_ref(std::shared_ptr<filter const> func) : filter_(std::move(func)) { }
+
+    template<class type>
+    bool operator() (type const &value) const {
+        return !filter_ || (*filter_)(value);
+    }
+private:
+    std::shared_ptr<filter const> filter_;
+};
+
 template<class iter, class base_policy, class policy, class filter =
          filter_true<iter>>
 struct iterator : public base_policy, policy {
@@ -126,7 +146,7 @@ struct iterator : public base_policy, policy {
     typedef typename base_policy::pointer           pointer;
     typedef          std::ptrdiff_t                 difference_type;
     typedef          std::forward_iterator_tag      iterator_category;
-    typedef          std::function<bool(iter)>      filter_function ;
+    typedef          filter                         filter_function ;
 
     using base_policy::iter_;
     using base_policy::flag_const_value;
@@ -0,0 +1,112 @@
+#ifndef MATERIALIZE_H
+#define MATERIALIZE_H
+
+#include "vector"
+#include "algorithm"
+#include "future"
+#include "csr_graph.h"
+#include "parallel.hpp"
+
+namespace au {
+
+// Evaluates the vertex and edge filters of fg exactly once and copies the
+// surviving part of the base graph into a csr_graph with dense vertex ids,
+// with edge_order::by_data the out-edges of every vertex are sorted by data
+// (see csr_graph::edge_range).
+// Filters run concurrently on pool workers, so they must be thread safe.
+template<class filtered>
+csr_graph<typename filtered::vertex_data, typename filtered::edge_data>
+materialize(filtered const& fg, thread_pool& pool,
+            edge_order order = edge_order::base) {
+    typedef typename filtered::vertex_data                      vertex_data;
+    typedef csr_graph<vertex_data, typename filtered::edge_data> result_graph;
+    typedef typename result_graph::edge                         edge;
+    typedef typename result_graph::edge_set                     edge_set;
+
+    auto const& g = fg.base_graph();
+
+    std::vector<vertex_data> all;
+    for (auto iter = g.vertex_begin(); iter != g.vertex_end(); ++iter) {
+        all.push_back(*iter);
+    }
+
+    // vertex filter, then dense ids of the survivors by prefix sum
+    std::vector<char> keep(all.size());
+    std::vector<size_t> new_id(all.size());
+    size_t step = detail::default_grain(pool, all.size());
+    detail::parallel_chunks(pool, all.size(), step,
+                            [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            keep[i] = fg.vertex_predicate()(all[i]) ? 1 : 0;
+            new_id[i] = keep[i];
+        }
+    });
+    size_t count = parallel_exclusive_scan(pool, new_id.begin(), new_id.end(),
+                                           size_t(0));
+
+    auto vertices = std::make_shared<typename result_graph::vertexies>(count);
+    detail::parallel_chunks(pool, all.size(), step,
+                            [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (keep[i]) {
+                (*vertices)[new_id[i]] = all[i];
+            }
+        }
+    });
+
+    typename result_graph::vertex_ids ids;
+    ids.reserve(count);
+    for (size_t id = 0; id < count; ++id) {
+        ids.insert({(*vertices)[id], id});
+    }
+
+    // edge filter: every chunk of new ids collects its surviving edges
+    // locally and counts degrees, offsets are the prefix sum of degrees
+    typename result_graph::offsets offsets(count + 1, 0);
+    size_t edge_step = detail::default_grain(pool, count);
+    std::vector<edge_set> local(detail::chunk_count(count, edge_step));
+    detail::parallel_chunks(pool, count, edge_step,
+                            [&](size_t chunk, size_t begin, size_t end) {
+        for (size_t id = begin; id < end; ++id) {
+            auto from = g.find_vertex((*vertices)[id]);
+            auto edge_end = g.edge_end(from);
+            for (auto iter = g.edge_begin(from); iter != edge_end; ++iter) {
+                if (!fg.edge_predicate()(*iter)) {
+                    continue;
+                }
+                auto to = ids.find(*iter.to());
+                if (to == ids.end()) {
+                    continue;
+                }
+                local[chunk].push_back(edge(id, to->second, *iter,
+                                            vertices.get()));
+                ++offsets[id];
+            }
+        }
+    });
+    size_t edge_count = parallel_exclusive_scan(pool, offsets.begin(), offsets.end(),
+                                                size_t(0));
+
+    edge_set edges(edge_count);
+    detail::parallel_chunks(pool, count, edge_step,
+                            [&](size_t chunk, size_t begin, size_t end) {
+        std::move(local[chunk].begin(), local[chunk].end(),
+                  edges.begin() + offsets[begin]);
+        if (order == edge_order::by_data) {
+            for (size_t id = begin; id < end; ++id) {
+                std::stable_sort(edges.begin() + offsets[id],
+                                 edges.begin() + offsets[id + 1],
+                                 [](edge const& lhs, edge const& rhs) {
+                                     return lhs.data() < rhs.data();
+                                 });
+            }
+        }
+    });
+
+    return result_graph(std::move(vertices), std::move(ids),
+                        std::move(offsets), std::move(edges), order);
+}
+
+} // namespace au
+
+#endif // MATERIALIZE_H
@@ -0,0 +1,181 @@
+#ifndef PREDICATES_H
+#define PREDICATES_H
+
+#include "unordered_set"
+#include "memory"
+#include "utility"
+#include "limits"
+#include "filtered_graph.h"
+
+namespace au {
+
+// Predicate combinators for filtered_graph. Every combinator is a plain
+// functor templated on its operands, so a composed filter is one type whose
+// operator() the compiler can inline completely (no std::function).
+
+template<class left, class right>
+class and_predicate {
+public:
+    and_predicate() = default;
+    and_predicate(left const& lhs, right const& rhs) : lhs_(lhs), rhs_(rhs) { }
+
+    template<class type>
+    bool operator()(type const& value) const {
+        return lhs_(value) && rhs_(value);
+    }
+private:
+    left  lhs_;
+    right rhs_;
+};
+
+template<class left, class right>
+class or_predicate {
+public:
+    or_predicate() = default;
+    or_predicate(left const& lhs, right const& rhs) : lhs_(lhs), rhs_(rhs) { }
+
+    template<class type>
+    bool operator()(type const& value) const {
+        return lhs_(value) || rhs_(value);
+    }
+private:
+    left  lhs_;
+    right rhs_;
+};
+
+template<class predicate>
+class not_predicate {
+public:
+    not_predicate() = default;
+    not_predicate(predicate const& pred) : pred_(pred) { }
+
+    template<class type>
+    bool operator()(type const& value) const {
+        return !pred_(value);
+    }
+private:
+    predicate pred_;
+};
+
+// low <= value && value <= high
+template<class type>
+class range_predicate {
+public:
+    typedef type value_type;
+
+    range_predicate() = default;
+    range_predicate(type const& low, type const& high) : low_(low), high_(high) { }
+
+    bool operator()(type const& value) const {
+        return !(value < low_) && !(high_ < value);
+    }
+
+    type const& low() const {
+        return low_;
+    }
+
+    type const& high() const {
+        return high_;
+    }
+private:
+    type low_;
+    type high_;
+};
+
+// value is one of a fixed set, the set is shared between copies
+template<class type>
+class set_predicate {
+public:
+    typedef std::unordered_set<type> values;
+
+    set_predicate() : values_(std::make_shared<values>()) { }
+    set_predicate(values set) : values_(std::make_shared<values>(std::move(set))) { }
+
+    bool operator()(type const& value) const {
+        return values_->find(value) != values_->end();
+    }
+private:
+    std::shared_ptr<values const> values_;
+};
+
+template<class left, class right>
+and_predicate<left, right> and_(left const& lhs, right const& rhs) {
+    return and_predicate<left, right>(lhs, rhs);
+}
+
+template<class first, class second, class third, class... rest>
+auto and_(first const& lhs, second const& rhs, third const& next,
+          rest const&... tail) {
+    return and_(and_(lhs, rhs), next, tail...);
+}
+
+template<class left, class right>
+or_predicate<left, right> or_(left const& lhs, right const& rhs) {
+    return or_predicate<left, right>(lhs, rhs);
+}
+
+template<class first, class second, class third, class... rest>
+auto or_(first const& lhs, second const& rhs, third const& next,
+          rest const&... tail) {
+    return or_(or_(lhs, rhs), next, tail...);
+}
+
+template<class predicate>
+not_predicate<predicate> not_(predicate const& pred) {
+    return not_predicate<predicate>(pred);
+}
+
+template<class type>
+range_predicate<type> in_range(type const& low, type const& high) {
+    return range_predicate<type>(low, high);
+}
+
+template<class type>
+range_predicate<type> at_least(type const& low) {
+    static_assert(std::numeric_limits<type>::is_specialized,
+                  "at_least needs numeric_limits<type>, use in_range");
+    return range_predicate<type>(low, std::numeric_limits<type>::max());
+}
+
+template<class type>
+range_predicate<type> at_most(type const& high) {
+    static_assert(std::numeric_limits<type>::is_specialized,
+                  "at_most needs numeric_limits<type>, use in_range");
+    return range_predicate<type>(std::numeric_limits<type>::lowest(), high);
+}
+
+template<class type>
+set_predicate<type> in_set(std::initializer_list<type> values) {
+    return set_predicate<type>(typename set_predicate<type>::values(values));
+}
+
+template<class type>
+set_predicate<type> in_set(std::unordered_set<type> values) {
+    return set_predicate<type>(std::move(values));
+}
+
+template<class graph, class vertex_filter, class edge_filter>
+filtered_graph<graph, vertex_filter, edge_filter>
+make_filtered_graph(graph const& g, vertex_filter const& filter_vertex,
+                    edge_filter const& filter_edge) {
+    return filtered_graph<graph, vertex_filter, edge_filter>(g, filter_vertex,
+                                                             filter_edge);
+}
+
+// filtering a filtered_graph again filters its base graph with the
+// conjunction of both filters instead of stacking two layers of iterators
+template<class graph, class inner_vertex, class inner_edge,
+         class vertex_filter, class edge_filter>
+filtered_graph<graph, and_predicate<inner_vertex, vertex_filter>,
+               and_predicate<inner_edge, edge_filter>>
+make_filtered_graph(filtered_graph<graph, inner_vertex, inner_edge> const& g,
+                    vertex_filter const& filter_vertex,
+                    edge_filter const& filter_edge) {
+    return make_filtered_graph(g.base_graph(),
+                               and_(g.vertex_predicate(), filter_vertex),
+                               and_(g.edge_predicate(), filter_edge));
+}
+
+} // namespace au
+
+#endif // PREDICATES_H
@@ -0,0 +1,192 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include "atomic"
+#include "chrono"
+#include "condition_variable"
+#include "exception"
+#include "functional"
+#include "memory"
+#include "mutex"
+#include "stdexcept"
+#include "unordered_map"
+#include "vector"
+#include "graph.h"
+#include "thread_pool.hpp"
+
+namespace au {
+
+namespace detail {
+
+// Dependencies of a graph with dense indices: successors of every vertex
+// and the number of its predecessors, counted down as they finish.
+template<class vertex_data>
+struct dag_state {
+    std::vector<vertex_data>                vertices;
+    std::vector<std::vector<size_t>>        successors;
+    std::unique_ptr<std::atomic<size_t>[]>  waiting;
+    std::atomic<size_t>                     remaining{0};
+    std::atomic_bool                        failed{false};
+    std::exception_ptr                      error;
+    std::mutex                              mutex;
+    std::condition_variable                 done;
+
+    // the first error is kept, the vertices not started yet are skipped
+    void fail(std::exception_ptr exception) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+            error = exception;
+        }
+        failed = true;
+    }
+};
+
+} // namespace detail
+
+// Runs func(vertex) for every vertex of g on the pool, after func finished
+// for all its predecessors: an edge from -> to means that to depends on
+// from. Vertices without pending predecessors are posted to the pool; a
+// finishing task counts down the successors and continues itself with one
+// that became ready, posting the others. The calling thread helps running
+// tasks until all are done (so a task of the same pool may call it).
+// Throws std::logic_error if g has a cycle, before running anything.
+// After the first exception thrown by func the tasks not yet started are
+// skipped; the exception is rethrown once the running ones finished. A task
+// the pool refuses or drops (e.g. queue_full under the reject policy) fails
+// the run the same way with std::future_error(broken_promise); the vertices
+// after it are then counted down on the spot, without func.
+// g must not change during the call.
+template<class vertex_type, class edge_type, class function>
+void execute_dag(graph<vertex_type, edge_type> const& g, thread_pool& pool,
+                 function const& func) {
+    typedef detail::dag_state<vertex_type> state_type;
+    auto state = std::make_shared<state_type>();
+
+    std::unordered_map<vertex_type, size_t> index;
+    for (auto iter = g.vertex_begin(); iter != g.vertex_end(); ++iter) {
+        index.insert({*iter, state->vertices.size()});
+        state->vertices.push_back(*iter);
+    }
+    size_t count = state->vertices.size();
+    state->successors.resize(count);
+    std::vector<size_t> in_degree(count, 0);
+    for (auto iter = g.vertex_begin(); iter != g.vertex_end(); ++iter) {
+        size_t from = index[*iter];
+        for (auto edge = g.edge_begin(iter); edge != g.edge_end(iter); ++edge) {
+            size_t to = index[*edge.to()];
+            state->successors[from].push_back(to);
+            ++in_degree[to];
+        }
+    }
+
+    // Kahn's algorithm on a copy of the degrees: everything is reachable
+    // from the roots only if there is no cycle
+    std::vector<size_t> roots;
+    {
+        std::vector<size_t> degree = in_degree;
+        std::vector<size_t> order;
+        for (size_t i = 0; i < count; ++i) {
+            if (degree[i] == 0) {
+                order.push_back(i);
+            }
+        }
+        roots = order;
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (size_t next : state->successors[order[i]]) {
+                if (--degree[next] == 0) {
+                    order.push_back(next);
+                }
+            }
+        }
+        if (order.size() != count) {
+            throw std::logic_error("execute_dag: dependency cycle");
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+
+    state->waiting.reset(new std::atomic<size_t>[count]);
+    for (size_t i = 0; i < count; ++i) {
+        state->waiting[i].store(in_degree[i], std::memory_order_relaxed);
+    }
+    state->remaining.store(count);
+
+    // runs vertex and the chain of successors it makes ready
+    auto run = std::make_shared<std::function<void(size_t)>>();
+    std::weak_ptr<std::function<void(size_t)>> weak_run = run;
+    // a task for vertex, which fails the run and skips vertex (and what
+    // follows it) if the pool refuses or drops it
+    auto post = [state, &pool](std::shared_ptr<std::function<void(size_t)>> const& target,
+                               size_t vertex) {
+        try {
+            pool.post(detail::on_discard([target, vertex] {
+                (*target)(vertex);
+            }, [state, target, vertex] {
+                state->fail(detail::broken_promise());
+                (*target)(vertex);
+            }));
+        } catch (...) {
+            // the fallback already ran
+        }
+    };
+    *run = [state, &func, weak_run, post](size_t vertex) {
+        auto self = weak_run.lock();
+        // after a failure nothing is posted, the skipped vertices are
+        // counted down here
+        std::vector<size_t> skipped;
+        while (true) {
+            if (!state->failed) {
+                try {
+                    func(state->vertices[vertex]);
+                } catch (...) {
+                    state->fail(std::current_exception());
+                }
+            }
+            size_t next = state->successors.size();
+            for (size_t successor : state->successors[vertex]) {
+                if (state->waiting[successor].fetch_sub(1) != 1) {
+                    continue;
+                }
+                if (next == state->successors.size()) {
+                    next = successor;
+                } else if (state->failed) {
+                    skipped.push_back(successor);
+                } else {
+                    post(self, successor);
+                }
+            }
+            if (state->remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->done.notify_all();
+            }
+            if (next == state->successors.size()) {
+                if (skipped.empty()) {
+                    return;
+                }
+                next = skipped.back();
+                skipped.pop_back();
+            }
+            vertex = next;
+        }
+    };
+
+    for (size_t root : roots) {
+        post(run, root);
+    }
+    pool.help_until([&state] {
+        return state->remaining.load() == 0;
+    }, [&state](std::chrono::microseconds pause) {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->done.wait_for(lock, pause, [&state] {
+            return state->remaining.load() == 0;
+        });
+    });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+} // namespace au
+
+#endif // TASK_GRAPH_H
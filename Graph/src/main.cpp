@@ -10,6 +10,11 @@
 #include "graph.h"
 #include "filtered_graph.h"
 #include "path_finding.h"
+#include "materialize.h"
+#include "filtered_view.h"
+#include "predicates.h"
+#include "edge_range_graph.h"
+#include "task_graph.h"
 using namespace std;
 
 template<class T>
@@ -240,6 +245,213 @@ void check_shortest_path()
     assert((collect_vertex_path(fg, 4, 4) == std::vector<int>{4}));
 }
 
+void check_materialize()
+{
+    auto g  = make_simple_graph();
+    auto fg = make_simple_filtered(g);
+
+    au::thread_pool pool(4, 16);
+    auto cg = au::materialize(fg, pool);
+
+    auto v1 = cg.find_vertex(1);
+    auto v2 = cg.find_vertex(2);
+    auto v4 = cg.find_vertex(4);
+
+    assert(cg.vertex_count() == 3);
+    assert(cg.edge_count() == 2);
+    assert(cg.find_vertex(3) == cg.vertex_end());
+
+    check_iterator_concept(cg.vertex_begin(), true);
+    check_iterator_concept(cg.edge_begin(v4), true);
+
+    using std::distance;
+    assert(distance(cg.vertex_begin(), cg.vertex_end()) == 3);
+    assert(distance(cg.edge_begin(v1), cg.edge_end(v1)) == 0);
+    assert(distance(cg.edge_begin(v4), cg.edge_end(v4)) == 2);
+
+    assert(cg.find_edge(v1, v2) == cg.edge_end(v1));
+    assert(*cg.find_edge(v4, v2) == 2);
+
+    assert((collect_vertex_path(cg, 4, 1) == std::vector<int>{4, 1}));
+    assert((collect_vertex_path(cg, 4, 3) == std::vector<int>{}));
+    assert((collect_vertex_path(cg, 4, 4) == std::vector<int>{4}));
+}
+
+void check_materialize_large()
+{
+    const int max_id = 2000;
+
+    simple_graph_t g;
+    for (int i = 0; i < max_id; ++i)
+        g.add_vertex(i);
+    for (int i = 0; i + 7 < max_id; ++i) {
+        g.add_edge(g.find_vertex(i), g.find_vertex(i + 1), i % 5);
+        g.add_edge(g.find_vertex(i), g.find_vertex(i + 7), i % 3);
+    }
+
+    simple_filtered_t fg(g, [](int v) { return v % 3 != 0; },
+                         [](int e) { return e != 2; });
+
+    au::thread_pool pool(3, 8);
+    auto cg = au::materialize(fg, pool);
+
+    using std::distance;
+    assert(distance(cg.vertex_begin(), cg.vertex_end()) ==
+           distance(fg.vertex_begin(), fg.vertex_end()));
+    for (auto v = fg.vertex_begin(); v != fg.vertex_end(); ++v) {
+        auto cv = cg.find_vertex(*v);
+        assert(cv != cg.vertex_end());
+        assert(distance(cg.edge_begin(cv), cg.edge_end(cv)) ==
+               distance(fg.edge_begin(v), fg.edge_end(v)));
+    }
+
+    assert(collect_vertex_path(cg, 1, 500) == collect_vertex_path(fg, 1, 500));
+}
+
+void check_filtered_view()
+{
+    auto g = make_simple_graph();
+
+    au::filtered_view<simple_graph_t, std::function<bool(int)>,
+                      std::function<bool(int)>>
+            view(g, [](int v) { return v != 3; }, [](int e) { return e != 1; });
+
+    using std::distance;
+    auto v4 = view.find_vertex(4);
+    assert(view.find_vertex(3) == view.vertex_end());
+    assert(distance(view.edge_begin(v4), view.edge_end(v4)) == 2);
+    assert((collect_vertex_path(view, 4, 1) == std::vector<int>{4, 1}));
+
+    g.add_vertex(5);
+    g.add_vertex(6);
+    g.add_edge(g.find_vertex(2), g.find_vertex(5), 4);
+    g.add_edge(g.find_vertex(5), g.find_vertex(6), 1);
+    g.add_edge(g.find_vertex(5), g.find_vertex(3), 4);
+    assert(view.find_vertex(5) != view.vertex_end());
+    assert(distance(view.edge_begin(view.find_vertex(5)),
+                    view.edge_end(view.find_vertex(5))) == 0);
+    assert((collect_vertex_path(view, 4, 5) == std::vector<int>{4, 2, 5}));
+
+    g.remove_edge(g.find_edge(g.find_vertex(4), g.find_vertex(2)));
+    assert((collect_vertex_path(view, 4, 5) == std::vector<int>{}));
+
+    g.add_edge(g.find_vertex(1), g.find_vertex(5), 7);
+    assert((collect_vertex_path(view, 4, 5) == std::vector<int>{4, 1, 5}));
+
+    g.remove_vertex(g.find_vertex(1));
+    assert(view.find_vertex(1) == view.vertex_end());
+    assert(distance(view.edge_begin(view.find_vertex(4)),
+                    view.edge_end(view.find_vertex(4))) == 0);
+    assert((collect_vertex_path(view, 4, 5) == std::vector<int>{}));
+}
+
+void check_unsubscribe_from_listener()
+{
+    simple_graph_t g;
+    int once = 0;
+    int always = 0;
+    size_t id = 0;
+    id = g.subscribe([&](simple_graph_t::change const&) {
+        ++once;
+        g.unsubscribe(id);
+    });
+    g.subscribe([&](simple_graph_t::change const&) { ++always; });
+
+    g.add_vertex(1);
+    g.add_vertex(2);
+    assert(once == 1);
+    assert(always == 2);
+}
+
+void check_predicates()
+{
+    auto g = make_simple_graph();
+
+    auto vertex_predicate = au::not_(au::in_set({3}));
+    auto edge_predicate   = au::or_(au::in_range(2, 2), au::in_range(3, 9),
+                                    [](int e) { return e == 10; });
+    auto fg = au::make_filtered_graph(g, vertex_predicate, edge_predicate);
+
+    assert(fg.find_vertex(3) == fg.vertex_end());
+    check_iterator_concept(fg.vertex_begin(), true);
+    check_iterator_concept(fg.edge_begin(fg.find_vertex(4)), true);
+
+    using std::distance;
+    auto v4 = fg.find_vertex(4);
+    assert(distance(fg.edge_begin(v4), fg.edge_end(v4)) == 2);
+    assert(distance(fg.edge_begin(fg.find_vertex(1)),
+                    fg.edge_end(fg.find_vertex(1))) == 0);
+
+    // filtering twice collapses into one filtered_graph over g
+    auto ffg = au::make_filtered_graph(fg, au::not_(au::in_set({2})),
+                                       au::in_range(0, 5));
+    static_assert(std::is_same<decltype(ffg)::vertex_const_iterator_graph,
+                  simple_graph_t::vertex_const_iterator>::value, "flattened");
+    assert(ffg.find_vertex(2) == ffg.vertex_end());
+    assert(distance(ffg.vertex_begin(), ffg.vertex_end()) == 2);
+    assert(distance(ffg.edge_begin(ffg.find_vertex(4)),
+                    ffg.edge_end(ffg.find_vertex(4))) == 1);
+    assert((collect_vertex_path(ffg, 4, 1) == std::vector<int>{4, 1}));
+
+    // explicit nesting still works, each layer without std::function
+    au::filtered_graph<decltype(fg), au::not_predicate<au::set_predicate<int>>,
+                       au::range_predicate<int>>
+            nested(fg, au::not_(au::in_set({2})), au::in_range(0, 5));
+    assert(distance(nested.vertex_begin(), nested.vertex_end()) == 2);
+    assert((collect_vertex_path(nested, 4, 1) == std::vector<int>{4, 1}));
+
+    // iterators keep the filters alive after their filtered_graph is gone
+    auto first = au::make_filtered_graph(g, vertex_predicate,
+                                         edge_predicate).vertex_begin();
+    auto last  = au::make_filtered_graph(g, vertex_predicate,
+                                         edge_predicate).vertex_end();
+    assert(distance(first, last) == distance(fg.vertex_begin(), fg.vertex_end()));
+}
+
+void check_edge_range()
+{
+    const int max_id = 300;
+
+    simple_graph_t g;
+    for (int i = 0; i < max_id; ++i)
+        g.add_vertex(i);
+    for (int i = 0; i + 3 < max_id; ++i) {
+        g.add_edge(g.find_vertex(i), g.find_vertex(i + 1), i % 7);
+        g.add_edge(g.find_vertex(i), g.find_vertex(i + 2), (i * 5) % 11);
+        g.add_edge(g.find_vertex(i), g.find_vertex(i + 3), (i * 3) % 13);
+    }
+
+    au::thread_pool pool(2, 8);
+    auto all = au::make_filtered_graph(g, filter_true<int>(),
+                                       filter_true<int>());
+    auto cg = au::materialize(all, pool, au::edge_order::by_data);
+    assert(cg.edge_count() == 3 * (max_id - 3));
+
+    for (auto capacity : {0, 3, 6, 12}) {
+        auto indexed  = au::restrict_edges(cg, au::at_least(capacity));
+        auto filtered = au::make_filtered_graph(g, filter_true<int>(),
+                                                au::at_least(capacity));
+        using std::distance;
+        for (auto v = cg.vertex_begin(); v != cg.vertex_end(); ++v) {
+            auto fv = filtered.find_vertex(*v);
+            assert(distance(indexed.edge_begin(v), indexed.edge_end(v)) ==
+                   distance(filtered.edge_begin(fv), filtered.edge_end(fv)));
+            for (auto e = indexed.edge_begin(v); e != indexed.edge_end(v); ++e)
+                assert(*e >= capacity);
+        }
+        assert(collect_vertex_path(indexed, 0, max_id - 1) ==
+               collect_vertex_path(filtered, 0, max_id - 1));
+    }
+
+    auto unsorted = au::materialize(all, pool);
+    bool thrown = false;
+    try {
+        au::restrict_edges(unsorted, au::at_least(1));
+    } catch (std::logic_error const&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
 
 void test() {
     auto g = make_simple_graph();
@@ -247,6 +459,85 @@ void test() {
     g.remove_vertex(g.find_vertex(2));
 }
 
+void check_execute_dag()
+{
+    // 1 -> 2 -> 4, 1 -> 3 -> 4, 4 -> 5, and 100 independent vertices
+    au::graph<int, int> g;
+    for (int i = 1; i <= 5; ++i) {
+        g.add_vertex(i);
+    }
+    for (int i = 10; i < 110; ++i) {
+        g.add_vertex(i);
+    }
+    g.add_edge(g.find_vertex(1), g.find_vertex(2), 0);
+    g.add_edge(g.find_vertex(1), g.find_vertex(3), 0);
+    g.add_edge(g.find_vertex(2), g.find_vertex(4), 0);
+    g.add_edge(g.find_vertex(3), g.find_vertex(4), 0);
+    g.add_edge(g.find_vertex(4), g.find_vertex(5), 0);
+
+    au::thread_pool pool(4, 16);
+    std::mutex mutex;
+    std::vector<int> order;
+    au::execute_dag(g, pool, [&mutex, &order](int vertex) {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(vertex);
+    });
+    assert(order.size() == 105);
+    auto position = [&order](int vertex) {
+        return std::find(order.begin(), order.end(), vertex) - order.begin();
+    };
+    assert(position(1) < position(2) && position(1) < position(3));
+    assert(position(2) < position(4) && position(3) < position(4));
+    assert(position(4) < position(5));
+
+    // from a task of the same pool, with a failing vertex
+    std::atomic<int> ran(0);
+    auto nested = pool.submit([&g, &pool, &ran] {
+        try {
+            au::execute_dag(g, pool, [&ran](int vertex) {
+                if (vertex == 2) {
+                    throw std::runtime_error("vertex 2");
+                }
+                ++ran;
+            });
+        } catch (std::runtime_error const&) {
+            return true;
+        }
+        return false;
+    });
+    assert(pool.get(nested));
+    assert(ran < 104);
+
+    // a pool refusing a task fails the run instead of leaving it waiting
+    au::thread_pool small(1, 1);
+    small.set_backpressure(au::backpressure{au::overflow_policy::reject});
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    small.post([opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+    });
+    blocked.get_future().wait();
+    bool refused = false;
+    try {
+        au::execute_dag(g, small, [](int) {});
+    } catch (std::future_error const&) {
+        refused = true;
+    }
+    gate.set_value();
+    assert(refused);
+
+    g.add_edge(g.find_vertex(5), g.find_vertex(1), 0);
+    bool cycle = false;
+    try {
+        au::execute_dag(g, pool, [](int) {});
+    } catch (std::logic_error const&) {
+        cycle = true;
+    }
+    assert(cycle);
+}
+
 int main() {
 
     check_graph_concept();
@@ -255,6 +546,13 @@ int main() {
 
     check_shortest_path();
     check_filtered_graph();
+    check_materialize();
+    check_materialize_large();
+    check_filtered_view();
+    check_unsubscribe_from_listener();
+    check_predicates();
+    check_edge_range();
+    check_execute_dag();
 
     test ();
     return 0;
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <thread>
+
+
+namespace au {
+
+    // Bounds and tuning of the controller started by
+    // thread_pool::enable_autoscaling. Every period the controller estimates
+    // the queueing delay (tasks waiting / tasks done per second, Little's
+    // law) and the utilization (share of workers not parked), both smoothed
+    // with an exponential moving average. It adds workers while tasks wait
+    // longer than target_delay and the workers are busy, and removes one
+    // when most of them idle. max_threads is further capped by the CPUs the
+    // process may use (cgroup quota, then hardware_concurrency).
+    struct autoscale_options {
+        size_t min_threads = 1;
+        size_t max_threads = 0; // 0: the CPU limit
+        std::chrono::milliseconds period{50};
+        std::chrono::microseconds target_delay{1000};
+        double busy_utilization = 0.85;
+        double idle_utilization = 0.5;
+        double smoothing = 0.3; // weight of the newest sample
+    };
+
+namespace detail {
+
+    // CPUs granted by the cgroup CPU controller, 0 if there is no quota;
+    // cgroup v2 "cpu.max" holds "quota period" or "max period", cgroup v1
+    // keeps them in two files with -1 for no quota
+    inline size_t cgroup_cpu_quota() {
+        double quota = -1;
+        double period = 0;
+        std::ifstream v2("/sys/fs/cgroup/cpu.max");
+        if (v2) {
+            std::string value;
+            v2 >> value >> period;
+            if (value != "max" && !value.empty()) {
+                quota = std::stod(value);
+            }
+        } else {
+            std::ifstream quota_file("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+            std::ifstream period_file("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+            if (quota_file && period_file) {
+                quota_file >> quota;
+                period_file >> period;
+            }
+        }
+        if (quota <= 0 || period <= 0) {
+            return 0;
+        }
+        return std::max<size_t>(1, static_cast<size_t>(std::ceil(quota / period)));
+    }
+
+    inline size_t cpu_limit() {
+        size_t hardware = std::max<unsigned>(1, std::thread::hardware_concurrency());
+        size_t quota = cgroup_cpu_quota();
+        return quota == 0 ? hardware : std::min(hardware, quota);
+    }
+
+    // smoothed measurements of the pool, updated once per period
+    struct load_estimate {
+        double utilization = 0;
+        double delay_us = 0;
+
+        void update(autoscale_options const &options, double utilization_sample,
+                    double delay_sample) {
+            utilization += options.smoothing * (utilization_sample - utilization);
+            delay_us += options.smoothing * (delay_sample - delay_us);
+        }
+    };
+
+    // thread count for the next period
+    inline size_t autoscale_target(autoscale_options const &options, size_t cpus,
+                                   size_t threads, load_estimate const &load) {
+        size_t high = options.max_threads == 0 ? cpus
+                                               : std::min(options.max_threads, cpus);
+        size_t low = std::min(std::max<size_t>(1, options.min_threads), high);
+        size_t target = threads;
+        if (load.delay_us > options.target_delay.count() &&
+            load.utilization >= options.busy_utilization) {
+            target = threads + std::max<size_t>(1, threads / 4);
+        } else if (load.utilization < options.idle_utilization) {
+            target = threads - std::min<size_t>(threads, 1);
+        }
+        return std::min(high, std::max(low, target));
+    }
+}
+// namespace detail
+}
+// namespace au
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+
+
+namespace au {
+namespace detail {
+
+    struct free_block {
+        free_block *next_;
+    };
+
+    // Free list of fixed size blocks shared by all threads. Blocks are moved
+    // in and out in batches, so the mutex is taken once per batch.
+    class block_list {
+    public:
+        void push(free_block *first, free_block *last, size_t count) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            last->next_ = head_;
+            head_ = first;
+            size_ += count;
+        }
+
+        free_block *pop(size_t max_count, size_t &count) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_block *first = head_;
+            free_block *last = nullptr;
+            count = 0;
+            while (head_ != nullptr && count < max_count) {
+                last = head_;
+                head_ = head_->next_;
+                ++count;
+            }
+            if (last != nullptr) {
+                last->next_ = nullptr;
+            }
+            size_ -= count;
+            return count == 0 ? nullptr : first;
+        }
+
+    private:
+        std::mutex mutex_;
+        free_block *head_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    // Allocator of block_size byte blocks: every thread keeps a small cache
+    // of free blocks, refilled from and spilled to the shared block_list.
+    // Memory is reused, never returned to the system.
+    template<size_t block_size>
+    class block_pool {
+    public:
+        static void *allocate() {
+            cache &local = local_cache();
+            if (local.head_ == nullptr) {
+                local.head_ = shared().pop(batch_, local.size_);
+                if (local.head_ == nullptr) {
+                    return ::operator new(block_size);
+                }
+            }
+            free_block *block = local.head_;
+            local.head_ = block->next_;
+            --local.size_;
+            return block;
+        }
+
+        static void deallocate(void *pointer) {
+            cache &local = local_cache();
+            free_block *block = static_cast<free_block *>(pointer);
+            block->next_ = local.head_;
+            local.head_ = block;
+            if (++local.size_ > 2 * batch_) {
+                local.spill(batch_);
+            }
+        }
+
+    private:
+        static_assert(block_size >= sizeof(free_block), "block too small");
+
+        static const size_t batch_ = 32;
+
+        struct cache {
+            ~cache() {
+                spill(size_);
+            }
+
+            void spill(size_t count) {
+                if (count == 0) {
+                    return;
+                }
+                free_block *first = head_;
+                free_block *last = head_;
+                for (size_t i = 1; i < count; ++i) {
+                    last = last->next_;
+                }
+                head_ = last->next_;
+                size_ -= count;
+                shared().push(first, last, count);
+            }
+
+            free_block *head_ = nullptr;
+            size_t size_ = 0;
+        };
+
+        static cache &local_cache() {
+            static thread_local cache local;
+            return local;
+        }
+
+        // never destroyed: thread caches may spill into it during exit
+        static block_list &shared() {
+            static block_list *list = new block_list;
+            return *list;
+        }
+    };
+
+    // size classes served by block_pool, larger requests go to operator new
+    template<class function>
+    auto with_block_pool(size_t size, function func) -> decltype(func(block_pool<64>())) {
+        if (size <= 64) {
+            return func(block_pool<64>());
+        }
+        if (size <= 128) {
+            return func(block_pool<128>());
+        }
+        if (size <= 256) {
+            return func(block_pool<256>());
+        }
+        return func(block_pool<512>());
+    }
+
+    static const size_t max_pooled_size = 512;
+
+    inline void *pooled_allocate(size_t size) {
+        if (size > max_pooled_size) {
+            return ::operator new(size);
+        }
+        return with_block_pool(size, [](auto pool) {
+            return decltype(pool)::allocate();
+        });
+    }
+
+    inline void pooled_deallocate(void *pointer, size_t size) {
+        if (size > max_pooled_size) {
+            ::operator delete(pointer);
+            return;
+        }
+        with_block_pool(size, [pointer](auto pool) {
+            decltype(pool)::deallocate(pointer);
+        });
+    }
+
+    // std allocator on top of the block pools, used for the shared state of
+    // the futures returned by thread_pool::submit
+    template<class type>
+    class pool_allocator {
+    public:
+        typedef type value_type;
+
+        pool_allocator() = default;
+
+        template<class other>
+        pool_allocator(pool_allocator<other> const &) {}
+
+        type *allocate(size_t count) {
+            static_assert(alignof(type) <= alignof(std::max_align_t),
+                          "over-aligned types are not pooled");
+            return static_cast<type *>(pooled_allocate(count * sizeof(type)));
+        }
+
+        void deallocate(type *pointer, size_t count) {
+            pooled_deallocate(pointer, count * sizeof(type));
+        }
+
+        template<class other>
+        bool operator==(pool_allocator<other> const &) const {
+            return true;
+        }
+
+        template<class other>
+        bool operator!=(pool_allocator<other> const &) const {
+            return false;
+        }
+    };
+}
+// namespace detail
+}
+// namespace au
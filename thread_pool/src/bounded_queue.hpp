@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+namespace au {
+namespace detail {
+
+    // Bounded lock-free MPMC ring buffer (D. Vyukov): every cell carries a
+    // sequence number telling whether it is ready to be written or read for
+    // the current lap, producers and consumers claim positions with a CAS.
+    template<class type>
+    class ring_buffer {
+    public:
+        explicit ring_buffer(size_t capacity) :
+                mask_(round_up(capacity) - 1), cells_(new cell[mask_ + 1]),
+                enqueue_pos_(0), dequeue_pos_(0) {
+            for (size_t i = 0; i <= mask_; ++i) {
+                cells_[i].sequence_.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        ring_buffer(ring_buffer const &) = delete;
+
+        ring_buffer &operator=(ring_buffer const &) = delete;
+
+        size_t capacity() const {
+            return mask_ + 1;
+        }
+
+        bool try_push(type const &value) {
+            size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+            for (;;) {
+                cell &current = cells_[pos & mask_];
+                size_t sequence = current.sequence_.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) -
+                                static_cast<intptr_t>(pos);
+                if (diff == 0) {
+                    if (enqueue_pos_.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                        current.data_ = value;
+                        current.sequence_.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = enqueue_pos_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool try_pop(type &value) {
+            size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+            for (;;) {
+                cell &current = cells_[pos & mask_];
+                size_t sequence = current.sequence_.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) -
+                                static_cast<intptr_t>(pos + 1);
+                if (diff == 0) {
+                    if (dequeue_pos_.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                        value = current.data_;
+                        current.sequence_.store(pos + mask_ + 1,
+                                                std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = dequeue_pos_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        struct cell {
+            std::atomic<size_t> sequence_;
+            type data_;
+        };
+
+        static size_t round_up(size_t capacity) {
+            size_t size = 2;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            return size;
+        }
+
+        static const size_t cache_line_ = 64;
+
+        // producers and consumers positions live on separate cache lines
+        size_t const mask_;
+        std::unique_ptr<cell[]> const cells_;
+        char padding_before_[cache_line_];
+        std::atomic<size_t> enqueue_pos_;
+        char padding_between_[cache_line_ - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> dequeue_pos_;
+        char padding_after_[cache_line_ - sizeof(std::atomic<size_t>)];
+    };
+
+    // Queue holding at most limit() elements on top of ring_buffer.
+    // The limit may be changed at any time: a slot is reserved on an atomic
+    // counter before pushing, and when the limit outgrows the ring a twice
+    // larger ring is appended. Producers always push to the newest ring,
+    // consumers drain the older rings first; rings are freed with the queue.
+    template<class type>
+    class bounded_queue {
+    public:
+        explicit bounded_queue(size_t limit) :
+                size_(0), limit_(limit), rings_count_(0) {
+            add_ring(limit);
+        }
+
+        bounded_queue(bounded_queue const &) = delete;
+
+        bounded_queue &operator=(bounded_queue const &) = delete;
+
+        ~bounded_queue() {
+            for (size_t i = 0; i < rings_count_.load(); ++i) {
+                delete rings_[i].load();
+            }
+        }
+
+        size_t limit() const {
+            return limit_.load(std::memory_order_relaxed);
+        }
+
+        size_t size() const {
+            return size_.load(std::memory_order_relaxed);
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        // calls must not overlap
+        void set_limit(size_t limit) {
+            size_t count = rings_count_.load(std::memory_order_relaxed);
+            if (rings_[count - 1].load(std::memory_order_relaxed)->capacity() < limit) {
+                add_ring(limit);
+            }
+            limit_.store(limit, std::memory_order_seq_cst);
+        }
+
+        // false if the queue already holds limit() elements
+        bool try_push(type const &value) {
+            size_t size = size_.load(std::memory_order_relaxed);
+            do {
+                if (size >= limit_.load(std::memory_order_relaxed)) {
+                    return false;
+                }
+            } while (!size_.compare_exchange_weak(size, size + 1,
+                                                  std::memory_order_seq_cst));
+            push_reserved(value);
+            return true;
+        }
+
+        // pushes as many of the count values as fit under the limit with a
+        // single reservation, returns how many were pushed
+        size_t try_push_n(type const *values, size_t count) {
+            size_t size = size_.load(std::memory_order_relaxed);
+            size_t reserved = 0;
+            do {
+                size_t limit = limit_.load(std::memory_order_relaxed);
+                if (size >= limit) {
+                    return 0;
+                }
+                reserved = std::min(count, limit - size);
+            } while (!size_.compare_exchange_weak(size, size + reserved,
+                                                  std::memory_order_seq_cst));
+            for (size_t i = 0; i < reserved; ++i) {
+                push_reserved(values[i]);
+            }
+            return reserved;
+        }
+
+        bool try_pop(type &value) {
+            if (size_.load(std::memory_order_seq_cst) == 0 || !pop_reserved(value)) {
+                return false;
+            }
+            size_.fetch_sub(1, std::memory_order_seq_cst);
+            return true;
+        }
+
+        // Takes out the values matching pred and hands them to on_removed;
+        // the others go back behind whatever was pushed meanwhile, their
+        // slots stay reserved. Looks at no more than the size() values queued
+        // when called, consumers may miss the ones being looked at. Returns
+        // how many were removed.
+        template<class predicate, class consumer>
+        size_t remove_if(predicate const &pred, consumer const &on_removed) {
+            std::vector<type> kept;
+            std::vector<type> removed;
+            type value;
+            for (size_t left = size(); left > 0 && pop_reserved(value); --left) {
+                if (pred(value)) {
+                    removed.push_back(value);
+                } else {
+                    kept.push_back(value);
+                }
+            }
+            for (auto const &item : kept) {
+                push_reserved(item);
+            }
+            size_.fetch_sub(removed.size(), std::memory_order_seq_cst);
+            for (auto const &item : removed) {
+                on_removed(item);
+            }
+            return removed.size();
+        }
+
+    private:
+        static const size_t max_rings_ = 64;
+
+        void add_ring(size_t limit) {
+            size_t count = rings_count_.load(std::memory_order_relaxed);
+            size_t capacity = limit;
+            if (count > 0) {
+                capacity = std::max(capacity, 2 * rings_[count - 1]
+                        .load(std::memory_order_relaxed)->capacity());
+            }
+            rings_[count].store(new ring_buffer<type>(capacity),
+                                std::memory_order_release);
+            rings_count_.store(count + 1, std::memory_order_release);
+        }
+
+        // a value out of the rings, its slot still counted in size_
+        bool pop_reserved(type &value) {
+            size_t count = rings_count_.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; ++i) {
+                if (rings_[i].load(std::memory_order_acquire)->try_pop(value)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void push_reserved(type const &value) {
+            // the newest ring has room for every reserved element, a push can
+            // only fail while a consumer still holds the cell or when it
+            // raced with a ring being appended
+            for (;;) {
+                size_t count = rings_count_.load(std::memory_order_acquire);
+                if (rings_[count - 1].load(std::memory_order_acquire)->try_push(value)) {
+                    return;
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        std::atomic<size_t> size_;
+        std::atomic<size_t> limit_;
+        std::atomic<size_t> rings_count_;
+        std::atomic<ring_buffer<type> *> rings_[max_rings_];
+    };
+}
+// namespace detail
+}
+// namespace au
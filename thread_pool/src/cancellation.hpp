@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+
+namespace au {
+namespace detail {
+
+    // counts cancel() calls of every source, so a pool can tell that no
+    // token was cancelled since it last looked at its queues
+    inline std::atomic<uint64_t> &cancellation_epoch() {
+        static std::atomic<uint64_t> epoch(0);
+        return epoch;
+    }
+}
+// namespace detail
+
+    class task_cancelled : public std::runtime_error {
+    public:
+        task_cancelled() : std::runtime_error("task cancelled") {}
+    };
+
+    // Read side of a cancellation_source. Copies share the state, so a token
+    // can be captured by any number of tasks; a default constructed token is
+    // never cancelled.
+    class cancellation_token {
+    public:
+        cancellation_token() = default;
+
+        bool cancelled() const {
+            return state_ && state_->load(std::memory_order_acquire);
+        }
+
+        // for long running tasks polling the token
+        void throw_if_cancelled() const {
+            if (cancelled()) {
+                throw task_cancelled();
+            }
+        }
+
+    private:
+        friend class cancellation_source;
+
+        explicit cancellation_token(std::shared_ptr<std::atomic_bool> state) :
+                state_(std::move(state)) {}
+
+        std::shared_ptr<std::atomic_bool> state_;
+    };
+
+    // Cancels every task submitted with one of its tokens: queued tasks are
+    // skipped when a worker takes them (or when a producer finds their lane
+    // full), their futures get task_cancelled; running tasks notice only by
+    // polling the token.
+    class cancellation_source {
+    public:
+        cancellation_source() : state_(std::make_shared<std::atomic_bool>(false)) {}
+
+        cancellation_token token() const {
+            return cancellation_token(state_);
+        }
+
+        void cancel() {
+            state_->store(true, std::memory_order_release);
+            detail::cancellation_epoch().fetch_add(1, std::memory_order_seq_cst);
+        }
+
+        bool cancelled() const {
+            return state_->load(std::memory_order_acquire);
+        }
+
+    private:
+        std::shared_ptr<std::atomic_bool> state_;
+    };
+}
+// namespace au
@@ -0,0 +1,287 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#ifdef AU_THREAD_POOL_COROUTINES
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+
+#include "block_pool.hpp"
+#include "future.hpp"
+
+
+namespace au {
+
+    template<class type = void>
+    class task;
+
+namespace detail {
+
+    // coroutine frames come from the same block pools as the tasks
+    struct pooled_frame {
+        static void *operator new(size_t size) {
+            return pooled_allocate(size);
+        }
+
+        static void operator delete(void *pointer, size_t size) {
+            pooled_deallocate(pointer, size);
+        }
+    };
+
+    struct task_promise_base : pooled_frame {
+        // resumes whoever awaited the task, by symmetric transfer, so long
+        // chains of tasks do not grow the stack
+        struct final_awaiter {
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            template<class promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise> handle) noexcept {
+                std::coroutine_handle<> next = handle.promise().continuation_;
+                if (next) {
+                    return next;
+                }
+                return std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        final_awaiter final_suspend() noexcept {
+            return {};
+        }
+
+        void unhandled_exception() {
+            error_ = std::current_exception();
+        }
+
+        std::coroutine_handle<> continuation_;
+        std::exception_ptr error_;
+    };
+
+    template<class type>
+    struct task_promise : task_promise_base {
+        au::task<type> get_return_object();
+
+        template<class value>
+        void return_value(value &&item) {
+            value_.emplace(std::forward<value>(item));
+        }
+
+        type result() {
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+            return std::move(*value_);
+        }
+
+        std::optional<type> value_;
+    };
+
+    template<>
+    struct task_promise<void> : task_promise_base {
+        au::task<void> get_return_object();
+
+        void return_void() {}
+
+        void result() {
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+        }
+    };
+}
+// namespace detail
+
+    // Lazy coroutine: the body starts when the task is awaited, and the
+    // awaiting coroutine continues on the thread that finishes it. A body
+    // that does co_await pool.schedule() moves to a worker of the pool; while
+    // suspended, a task holds no thread. spawn(pool, task) starts a task on
+    // the pool from ordinary code.
+    template<class type>
+    class task {
+    public:
+        typedef detail::task_promise<type> promise_type;
+        typedef std::coroutine_handle<promise_type> handle_type;
+
+        task() = default;
+
+        explicit task(handle_type handle) : handle_(handle) {}
+
+        task(task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+        task &operator=(task &&other) noexcept {
+            if (this != &other) {
+                destroy();
+                handle_ = std::exchange(other.handle_, nullptr);
+            }
+            return *this;
+        }
+
+        task(task const &) = delete;
+
+        task &operator=(task const &) = delete;
+
+        ~task() {
+            destroy();
+        }
+
+        bool valid() const {
+            return static_cast<bool>(handle_);
+        }
+
+        class awaiter {
+        public:
+            explicit awaiter(handle_type handle) : handle_(handle) {}
+
+            bool await_ready() const noexcept {
+                return handle_.done();
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle_.promise().continuation_ = awaiting;
+                return handle_;
+            }
+
+            type await_resume() {
+                return handle_.promise().result();
+            }
+
+        private:
+            handle_type handle_;
+        };
+
+        // a task is awaited once
+        awaiter operator co_await() && noexcept {
+            return awaiter(handle_);
+        }
+
+    private:
+        void destroy() {
+            if (handle_) {
+                handle_.destroy();
+                handle_ = nullptr;
+            }
+        }
+
+        handle_type handle_;
+    };
+
+namespace detail {
+
+    template<class type>
+    au::task<type> task_promise<type>::get_return_object() {
+        typedef typename au::task<type>::handle_type handle_type;
+        return au::task<type>(handle_type::from_promise(*this));
+    }
+
+    inline au::task<void> task_promise<void>::get_return_object() {
+        return au::task<void>(au::task<void>::handle_type::from_promise(*this));
+    }
+
+    // coroutine nobody awaits; its frame is freed when the body returns
+    struct detached_task {
+        struct promise_type : pooled_frame {
+            detached_task get_return_object() {
+                return {};
+            }
+
+            std::suspend_never initial_suspend() noexcept {
+                return {};
+            }
+
+            std::suspend_never final_suspend() noexcept {
+                return {};
+            }
+
+            void return_void() {}
+
+            void unhandled_exception() {
+                std::terminate();
+            }
+        };
+    };
+
+    template<class type>
+    detached_task start_task(thread_pool &pool, au::task<type> work,
+                             std::shared_ptr<future_state<type>> state) {
+        try {
+            co_await pool.schedule();
+            state->set_value(co_await std::move(work));
+        } catch (...) {
+            state->set_exception(std::current_exception());
+        }
+    }
+
+    inline detached_task start_task(thread_pool &pool, au::task<void> work,
+                                    std::shared_ptr<future_state<void>> state) {
+        try {
+            co_await pool.schedule();
+            co_await std::move(work);
+        } catch (...) {
+            state->set_exception(std::current_exception());
+            co_return;
+        }
+        state->set_value();
+    }
+
+    template<class type>
+    class future_awaiter {
+    public:
+        explicit future_awaiter(future<type> const &awaited) : future_(awaited) {}
+
+        bool await_ready() const {
+            return future_.ready();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            thread_pool *pool = future_.pool();
+            // resumed inline if the pool drops the task, get() then returns
+            // the ready value
+            future_.on_ready([pool, handle] {
+                dispatch(pool, [handle] {
+                    handle.resume();
+                }, [handle] {
+                    handle.resume();
+                });
+            });
+        }
+
+        type await_resume() const {
+            return future_.get();
+        }
+
+    private:
+        future<type> future_;
+    };
+}
+// namespace detail
+
+    // runs work on a worker of pool
+    template<class type>
+    future<type> spawn(thread_pool &pool, task<type> work) {
+        auto state = std::make_shared<detail::future_state<type>>(&pool);
+        detail::start_task(pool, std::move(work), state);
+        return future<type>(state);
+    }
+
+    // co_await on a future suspends until it is ready and resumes on its
+    // pool; the result is a copy of the value
+    template<class type>
+    detail::future_awaiter<type> operator co_await(future<type> const &awaited) {
+        return detail::future_awaiter<type>(awaited);
+    }
+}
+// namespace au
+
+#endif
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+
+namespace au {
+namespace detail {
+
+    // Earliest deadline first queue: a binary heap under a mutex. Entries
+    // with equal deadlines leave in insertion order. The size and the
+    // earliest deadline are kept in atomics, so polling an empty queue or
+    // one with nothing due yet takes no lock.
+    template<class type>
+    class deadline_queue {
+    public:
+        typedef std::chrono::steady_clock::time_point time_point;
+
+        deadline_queue() : size_(0), earliest_(never()), sequence_(0) {}
+
+        deadline_queue(deadline_queue const &) = delete;
+
+        deadline_queue &operator=(deadline_queue const &) = delete;
+
+        void push(time_point deadline, type const &value) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            heap_.push(entry{deadline, sequence_++, value});
+            earliest_.store(heap_.top().deadline_.time_since_epoch().count(),
+                            std::memory_order_relaxed);
+            size_.fetch_add(1, std::memory_order_seq_cst);
+        }
+
+        bool try_pop(type &value) {
+            if (size_.load(std::memory_order_seq_cst) == 0) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (heap_.empty()) {
+                return false;
+            }
+            pop(value);
+            return true;
+        }
+
+        // pops the earliest entry only if its deadline is not after limit
+        bool try_pop_before(time_point limit, type &value) {
+            if (size_.load(std::memory_order_seq_cst) == 0 ||
+                earliest_.load(std::memory_order_relaxed) > limit.time_since_epoch().count()) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (heap_.empty() || limit < heap_.top().deadline_) {
+                return false;
+            }
+            pop(value);
+            return true;
+        }
+
+        size_t size() const {
+            return size_.load(std::memory_order_relaxed);
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+    private:
+        typedef time_point::rep rep;
+
+        static rep never() {
+            return time_point::max().time_since_epoch().count();
+        }
+
+        // under the lock
+        void pop(type &value) {
+            value = heap_.top().value_;
+            heap_.pop();
+            earliest_.store(heap_.empty() ? never() : heap_.top().deadline_.time_since_epoch().count(),
+                            std::memory_order_relaxed);
+            size_.fetch_sub(1, std::memory_order_seq_cst);
+        }
+
+        struct entry {
+            time_point deadline_;
+            uint64_t sequence_;
+            type value_;
+
+            // std::priority_queue keeps the greatest on top
+            bool operator<(entry const &other) const {
+                if (deadline_ != other.deadline_) {
+                    return deadline_ > other.deadline_;
+                }
+                return sequence_ > other.sequence_;
+            }
+        };
+
+        std::mutex mutex_;
+        std::priority_queue<entry> heap_;
+        std::atomic<size_t> size_;
+        std::atomic<rep> earliest_;
+        uint64_t sequence_;
+    };
+}
+// namespace detail
+}
+// namespace au
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+
+namespace au {
+namespace detail {
+
+    // hint to the CPU that the thread is spinning
+    inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield" ::: "memory");
+#endif
+    }
+
+    // Event count (as in folly::EventCount): lets a thread block until some
+    // condition checked outside of any lock becomes true, without lost
+    // wake-ups and without the notifier touching a mutex when nobody waits.
+    //
+    //     auto key = event.prepare_wait();
+    //     if (condition()) { event.cancel_wait(); return; }
+    //     event.wait(key);
+    //
+    // The notifier makes the condition true, then calls notify_one/all.
+    // The state word keeps the number of waiters in the low 32 bits and an
+    // epoch in the high 32 bits; waiting blocks while the epoch is unchanged.
+    class event_count {
+    public:
+        typedef uint32_t key;
+
+        event_count() : state_(0) {}
+
+        event_count(event_count const &) = delete;
+
+        event_count &operator=(event_count const &) = delete;
+
+        key prepare_wait() {
+            uint64_t previous = state_.fetch_add(waiter_, std::memory_order_seq_cst);
+            return static_cast<key>(previous >> epoch_shift_);
+        }
+
+        void cancel_wait() {
+            state_.fetch_sub(waiter_, std::memory_order_seq_cst);
+        }
+
+        void wait(key epoch) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                condition_.wait(lock, [this, epoch] {
+                    return current_epoch() != epoch;
+                });
+            }
+            state_.fetch_sub(waiter_, std::memory_order_seq_cst);
+        }
+
+        // false if the deadline passed first
+        template<class clock, class duration>
+        bool wait_until(key epoch,
+                        std::chrono::time_point<clock, duration> const &deadline) {
+            bool woken = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                woken = condition_.wait_until(lock, deadline, [this, epoch] {
+                    return current_epoch() != epoch;
+                });
+            }
+            state_.fetch_sub(waiter_, std::memory_order_seq_cst);
+            return woken;
+        }
+
+        void notify_one() {
+            notify(false);
+        }
+
+        void notify_all() {
+            notify(true);
+        }
+
+        // wakes at most count waiters
+        void notify_n(size_t count) {
+            if (count == 0) {
+                return;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            size_t waiting = waiters();
+            if (waiting == 0) {
+                return;
+            }
+            state_.fetch_add(epoch_, std::memory_order_seq_cst);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (count >= waiting) {
+                condition_.notify_all();
+                return;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                condition_.notify_one();
+            }
+        }
+
+        size_t waiters() const {
+            return static_cast<size_t>(state_.load(std::memory_order_acquire) &
+                                       waiter_mask_);
+        }
+
+    private:
+        static const uint64_t waiter_ = 1;
+        static const uint64_t waiter_mask_ = 0xFFFFFFFFull;
+        static const int epoch_shift_ = 32;
+        static const uint64_t epoch_ = uint64_t(1) << epoch_shift_;
+
+        key current_epoch() const {
+            return static_cast<key>(state_.load(std::memory_order_acquire) >>
+                                    epoch_shift_);
+        }
+
+        void notify(bool all) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if ((state_.load(std::memory_order_acquire) & waiter_mask_) == 0) {
+                return;
+            }
+            state_.fetch_add(epoch_, std::memory_order_seq_cst);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (all) {
+                condition_.notify_all();
+            } else {
+                condition_.notify_one();
+            }
+        }
+
+        std::atomic<uint64_t> state_;
+        std::mutex mutex_;
+        std::condition_variable condition_;
+    };
+}
+// namespace detail
+}
+// namespace au
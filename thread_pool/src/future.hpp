@@ -0,0 +1,400 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+
+namespace au {
+
+    template<class type>
+    class future;
+
+namespace detail {
+
+    template<class type>
+    struct value_holder {
+        typedef type const &reference;
+
+        template<class value>
+        void set(value &&item) {
+            value_.reset(new type(std::forward<value>(item)));
+        }
+
+        reference get() const {
+            return *value_;
+        }
+
+        std::unique_ptr<type> value_;
+    };
+
+    template<>
+    struct value_holder<void> {
+        typedef void reference;
+
+        void set() {}
+
+        void get() const {}
+    };
+
+    // Shared state of au::future: the value or the exception, set once, and
+    // the callbacks to run when that happens. Callbacks run on the thread
+    // completing the state (or at once if it is already complete), so they
+    // only hand the real work over to the pool.
+    template<class type>
+    class future_state {
+    public:
+        typedef typename value_holder<type>::reference reference;
+
+        explicit future_state(thread_pool *pool) : pool_(pool), ready_(false) {}
+
+        thread_pool *pool() const {
+            return pool_;
+        }
+
+        bool ready() const {
+            return ready_.load(std::memory_order_acquire);
+        }
+
+        template<class... value>
+        void set_value(value &&... item) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            holder_.set(std::forward<value>(item)...);
+            complete(lock);
+        }
+
+        void set_exception(std::exception_ptr error) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            error_ = error;
+            complete(lock);
+        }
+
+        std::exception_ptr exception() const {
+            return error_;
+        }
+
+        void on_ready(std::function<void()> callback) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!ready_) {
+                    callbacks_.push_back(std::move(callback));
+                    return;
+                }
+            }
+            callback();
+        }
+
+        void wait_for(std::chrono::microseconds pause) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait_for(lock, pause, [this] {
+                return ready_.load();
+            });
+        }
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this] {
+                return ready_.load();
+            });
+        }
+
+        // only after ready()
+        reference get() const {
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+            return holder_.get();
+        }
+
+    private:
+        void complete(std::unique_lock<std::mutex> &lock) {
+            if (ready_) {
+                throw std::logic_error("future already satisfied");
+            }
+            ready_.store(true, std::memory_order_release);
+            std::vector<std::function<void()>> callbacks;
+            callbacks.swap(callbacks_);
+            lock.unlock();
+            condition_.notify_all();
+            for (auto &callback : callbacks) {
+                callback();
+            }
+        }
+
+        thread_pool *const pool_;
+        std::atomic_bool ready_;
+        std::mutex mutex_;
+        std::condition_variable condition_;
+        value_holder<type> holder_;
+        std::exception_ptr error_;
+        std::vector<std::function<void()>> callbacks_;
+    };
+
+    // runs func() and stores its result or exception in state
+    template<class type>
+    struct fulfil {
+        template<class function>
+        static void run(future_state<type> &state, function &&func) {
+            try {
+                state.set_value(func());
+            } catch (...) {
+                state.set_exception(std::current_exception());
+            }
+        }
+    };
+
+    template<>
+    struct fulfil<void> {
+        template<class function>
+        static void run(future_state<void> &state, function &&func) {
+            try {
+                func();
+            } catch (...) {
+                state.set_exception(std::current_exception());
+                return;
+            }
+            state.set_value();
+        }
+    };
+
+    // calls a continuation with the value of the completed antecedent
+    template<class type>
+    struct apply_value {
+        typedef type const &argument;
+
+        template<class function>
+        static auto call(function &func, future_state<type> const &state)
+        -> decltype(func(state.get())) {
+            return func(state.get());
+        }
+    };
+
+    template<>
+    struct apply_value<void> {
+        template<class function>
+        static auto call(function &func, future_state<void> const &)
+        -> decltype(func()) {
+            return func();
+        }
+    };
+
+    template<class function, class type>
+    struct continuation_result {
+        typedef typename std::decay<decltype(apply_value<type>::call(
+                std::declval<typename std::decay<function>::type &>(),
+                std::declval<future_state<type> const &>()))>::type type_;
+    };
+
+    // runs func on pool, inline if there is none; if the pool refuses or
+    // drops the task, fallback runs instead (exactly one of them runs)
+    template<class function, class fallback>
+    void dispatch(thread_pool *pool, function &&func, fallback &&on_drop) {
+        if (pool == nullptr) {
+            func();
+            return;
+        }
+        auto guarded = on_discard(std::forward<function>(func), std::forward<fallback>(on_drop));
+        try {
+            pool->post(std::move(guarded));
+        } catch (...) {
+            // the fallback ran when guarded (or the task made of it) was
+            // destroyed unrun
+        }
+    }
+}
+// namespace detail
+
+    // Future of a task started with spawn(). Unlike std::future it is a
+    // shared handle (copies refer to the same result, get() returns a const
+    // reference) and takes continuations: then(f) schedules f on the pool
+    // when the value is there instead of blocking a thread on it. An
+    // exception skips the continuations and is passed down the chain. A
+    // task the pool drops unrun (it is destroyed first) leaves its future
+    // with std::future_error(broken_promise), a ready future can be read
+    // after the pool is gone; adding continuations needs the pool.
+    template<class type>
+    class future {
+    public:
+        typedef typename detail::future_state<type>::reference reference;
+
+        future() = default;
+
+        explicit future(std::shared_ptr<detail::future_state<type>> state) :
+                state_(std::move(state)) {}
+
+        bool valid() const {
+            return state_ != nullptr;
+        }
+
+        bool ready() const {
+            return state_->ready();
+        }
+
+        // pool running the continuations, nullptr runs them inline
+        thread_pool *pool() const {
+            return state_->pool();
+        }
+
+        // a thread of the pool (or any other thread, if the pool has queued
+        // tasks) keeps running tasks of the pool while waiting
+        void wait() const {
+            std::shared_ptr<detail::future_state<type>> state = state_;
+            if (state->ready()) {
+                return;
+            }
+            if (state->pool() == nullptr) {
+                state->wait();
+                return;
+            }
+            state->pool()->help_until([&state] {
+                return state->ready();
+            }, [&state](std::chrono::microseconds pause) {
+                state->wait_for(pause);
+            });
+        }
+
+        reference get() const {
+            wait();
+            return state_->get();
+        }
+
+        // func(value) (func() for future<void>) runs on the pool once this
+        // future is ready; the result is the future of its return value
+        template<class function>
+        auto then(function &&func) const
+        -> future<typename detail::continuation_result<function, type>::type_> {
+            typedef typename detail::continuation_result<function, type>::type_ result;
+            std::shared_ptr<detail::future_state<type>> previous = state_;
+            auto next = std::make_shared<detail::future_state<result>>(previous->pool());
+            auto call = std::make_shared<typename std::decay<function>::type>(
+                    std::forward<function>(func));
+            previous->on_ready([previous, next, call] {
+                detail::dispatch(previous->pool(), [previous, next, call] {
+                    if (previous->exception()) {
+                        next->set_exception(previous->exception());
+                        return;
+                    }
+                    detail::fulfil<result>::run(*next, [&previous, &call] {
+                        return detail::apply_value<type>::call(*call, *previous);
+                    });
+                }, [next] {
+                    next->set_exception(detail::broken_promise());
+                });
+            });
+            return future<result>(next);
+        }
+
+        void on_ready(std::function<void()> callback) const {
+            state_->on_ready(std::move(callback));
+        }
+
+        std::exception_ptr exception() const {
+            return state_->exception();
+        }
+
+    private:
+        std::shared_ptr<detail::future_state<type>> state_;
+    };
+
+    // posts func(args...) to pool
+    template<class function, class... argument>
+    auto spawn(thread_pool &pool, function &&func, argument &&... args)
+    -> future<detail::result_of_t<function, argument...>> {
+        typedef detail::result_of_t<function, argument...> result;
+        auto state = std::make_shared<detail::future_state<result>>(&pool);
+        auto call = detail::bind_call(std::forward<function>(func),
+                                      std::forward<argument>(args)...);
+        pool.post(detail::on_discard([state, call]() mutable {
+            detail::fulfil<result>::run(*state, std::move(call));
+        }, [state] {
+            state->set_exception(detail::broken_promise());
+        }));
+        return future<result>(state);
+    }
+
+    // ready when all futures are, holds their values in order; fails with
+    // the first exception (by position) once all of them completed
+    template<class type>
+    future<std::vector<type>> when_all(std::vector<future<type>> const &futures) {
+        typedef std::vector<type> result;
+        thread_pool *pool = futures.empty() ? nullptr : futures.front().pool();
+        auto state = std::make_shared<detail::future_state<result>>(pool);
+        if (futures.empty()) {
+            state->set_value(result());
+            return future<result>(state);
+        }
+        auto remaining = std::make_shared<std::atomic<size_t>>(futures.size());
+        auto inputs = std::make_shared<std::vector<future<type>>>(futures);
+        for (auto const &item : futures) {
+            item.on_ready([state, remaining, inputs] {
+                if (remaining->fetch_sub(1) != 1) {
+                    return;
+                }
+                detail::fulfil<result>::run(*state, [&inputs] {
+                    result values;
+                    values.reserve(inputs->size());
+                    for (auto const &input : *inputs) {
+                        values.push_back(input.get());
+                    }
+                    return values;
+                });
+            });
+        }
+        return future<result>(state);
+    }
+
+    inline future<void> when_all(std::vector<future<void>> const &futures) {
+        thread_pool *pool = futures.empty() ? nullptr : futures.front().pool();
+        auto state = std::make_shared<detail::future_state<void>>(pool);
+        if (futures.empty()) {
+            state->set_value();
+            return future<void>(state);
+        }
+        auto remaining = std::make_shared<std::atomic<size_t>>(futures.size());
+        auto inputs = std::make_shared<std::vector<future<void>>>(futures);
+        for (auto const &item : futures) {
+            item.on_ready([state, remaining, inputs] {
+                if (remaining->fetch_sub(1) != 1) {
+                    return;
+                }
+                detail::fulfil<void>::run(*state, [&inputs] {
+                    for (auto const &input : *inputs) {
+                        input.get();
+                    }
+                });
+            });
+        }
+        return future<void>(state);
+    }
+
+    // ready when the first of futures completes (with a value or an
+    // exception), holds its index
+    template<class type>
+    future<size_t> when_any(std::vector<future<type>> const &futures) {
+        if (futures.empty()) {
+            throw std::invalid_argument("when_any of no futures");
+        }
+        auto state = std::make_shared<detail::future_state<size_t>>(futures.front().pool());
+        auto claimed = std::make_shared<std::atomic_bool>(false);
+        for (size_t i = 0; i < futures.size(); ++i) {
+            futures[i].on_ready([state, claimed, i] {
+                if (!claimed->exchange(true)) {
+                    state->set_value(i);
+                }
+            });
+        }
+        return future<size_t>(state);
+    }
+}
+// namespace au
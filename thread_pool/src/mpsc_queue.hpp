@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <utility>
+
+#include "block_pool.hpp"
+
+
+namespace au {
+namespace detail {
+
+    // Unbounded lock-free multi-producer single-consumer queue (D. Vyukov):
+    // a producer swaps its node into head_ with one exchange and then links
+    // it behind the previous head; the consumer walks from a stub node.
+    // Between the exchange and the link the queue looks shorter than it is,
+    // try_pop then fails although a push has started. Nodes come from the
+    // block pools.
+    template<class type>
+    class mpsc_queue {
+    public:
+        mpsc_queue() : head_(make_node(type())), tail_(head_.load()) {}
+
+        mpsc_queue(mpsc_queue const &) = delete;
+
+        mpsc_queue &operator=(mpsc_queue const &) = delete;
+
+        ~mpsc_queue() {
+            while (tail_ != nullptr) {
+                node *next = tail_->next_.load(std::memory_order_relaxed);
+                free_node(tail_);
+                tail_ = next;
+            }
+        }
+
+        // any thread
+        void push(type value) {
+            node *item = make_node(std::move(value));
+            node *previous = head_.exchange(item, std::memory_order_acq_rel);
+            previous->next_.store(item, std::memory_order_release);
+        }
+
+        // the consumer only
+        bool try_pop(type &value) {
+            node *next = tail_->next_.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                return false;
+            }
+            value = std::move(next->value_);
+            free_node(tail_);
+            tail_ = next;
+            return true;
+        }
+
+    private:
+        struct node {
+            explicit node(type value) : next_(nullptr), value_(std::move(value)) {}
+
+            std::atomic<node *> next_;
+            type value_;
+        };
+
+        static node *make_node(type value) {
+            void *memory = pooled_allocate(sizeof(node));
+            return new(memory) node(std::move(value));
+        }
+
+        static void free_node(node *item) {
+            item->~node();
+            pooled_deallocate(item, sizeof(node));
+        }
+
+        std::atomic<node *> head_;
+        // the stub: its value was taken (or is the default one)
+        node *tail_;
+    };
+}
+// namespace detail
+}
+// namespace au
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+
+namespace au {
+namespace detail {
+
+    // about eight chunks per worker: enough to even out uneven chunks,
+    // few enough to keep the per chunk overhead small
+    inline size_t default_grain(thread_pool const &pool, size_t size) {
+        size_t chunks = std::max<size_t>(1, std::min(size, pool.threads_count() * 8));
+        return std::max<size_t>(1, (size + chunks - 1) / chunks);
+    }
+
+    inline size_t chunk_count(size_t size, size_t grain) {
+        return grain == 0 ? 0 : (size + grain - 1) / grain;
+    }
+
+    // Chunks of one parallel call. Chunks are claimed with a fetch_add by
+    // the calling thread and by the helper tasks posted to the pool, so the
+    // caller finishes the work alone if no worker is free (also when it is a
+    // worker of the same pool) and only waits for chunks already running.
+    // Helpers that start after the call returned find nothing to claim.
+    class chunk_job {
+    public:
+        typedef std::function<void(size_t, size_t, size_t)> body;
+
+        chunk_job(size_t size, size_t grain, body const *func) :
+                size_(size), grain_(grain), chunks_(chunk_count(size, grain)),
+                func_(func), next_(0), done_(0) {}
+
+        size_t chunks() const {
+            return chunks_;
+        }
+
+        // runs claimed chunks until none is left
+        void work() {
+            for (;;) {
+                size_t chunk = next_.fetch_add(1);
+                if (chunk >= chunks_) {
+                    return;
+                }
+                try {
+                    size_t begin = chunk * grain_;
+                    (*func_)(chunk, begin, std::min(size_, begin + grain_));
+                } catch (...) {
+                    fail(std::current_exception());
+                }
+                finish(1);
+            }
+        }
+
+        // waits for the running chunks, rethrows the first exception
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this] {
+                return done_ == chunks_;
+            });
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+        }
+
+    private:
+        void fail(std::exception_ptr error) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_) {
+                    error_ = error;
+                }
+            }
+            // chunks nobody claimed yet are skipped and counted as done
+            size_t claimed = next_.exchange(chunks_);
+            if (claimed < chunks_) {
+                finish(chunks_ - claimed);
+            }
+        }
+
+        void finish(size_t count) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ += count;
+            if (done_ == chunks_) {
+                condition_.notify_all();
+            }
+        }
+
+        size_t const size_;
+        size_t const grain_;
+        size_t const chunks_;
+        body const *func_;
+        std::atomic<size_t> next_;
+        size_t done_;
+        std::exception_ptr error_;
+        std::mutex mutex_;
+        std::condition_variable condition_;
+    };
+
+    // runs func(chunk, begin, end) for the chunks [i * grain, (i + 1) * grain)
+    // of [0, size) on the pool and the calling thread, returns when all ran.
+    // When posting the helpers fails (full queue, stopped pool) the helpers
+    // posted before still refer to func, so the chunks are finished by the
+    // calling thread before the failure is rethrown.
+    inline void parallel_chunks(thread_pool &pool, size_t size, size_t grain,
+                                chunk_job::body const &func) {
+        auto job = std::make_shared<chunk_job>(size, grain, &func);
+        std::exception_ptr refused;
+        if (job->chunks() > 1) {
+            size_t helpers = std::min(job->chunks() - 1, pool.threads_count());
+            try {
+                pool.post_n(helpers, [job](size_t) {
+                    job->work();
+                });
+            } catch (...) {
+                refused = std::current_exception();
+            }
+        }
+        job->work();
+        job->wait();
+        if (refused) {
+            std::rethrow_exception(refused);
+        }
+    }
+}
+// namespace detail
+
+    // func(begin, end) is called for disjoint subranges of [begin, end)
+    // of at most grain indices, grain 0 picks one from the pool size
+    template<class function>
+    void parallel_for(thread_pool &pool, size_t begin, size_t end, size_t grain,
+                      function const &func) {
+        if (begin >= end) {
+            return;
+        }
+        size_t size = end - begin;
+        if (grain == 0) {
+            grain = detail::default_grain(pool, size);
+        }
+        detail::parallel_chunks(pool, size, grain,
+                                [begin, &func](size_t, size_t first, size_t last) {
+            func(begin + first, begin + last);
+        });
+    }
+
+    template<class function>
+    void parallel_for(thread_pool &pool, size_t begin, size_t end,
+                      function const &func) {
+        parallel_for(pool, begin, end, 0, func);
+    }
+
+    // func(begin, end) reduces a subrange to a value, the values are
+    // combined left to right starting with identity, so combine only has
+    // to be associative
+    template<class value, class function, class combiner>
+    value parallel_reduce(thread_pool &pool, size_t begin, size_t end, size_t grain,
+                          value identity, function const &func,
+                          combiner const &combine) {
+        if (begin >= end) {
+            return identity;
+        }
+        size_t size = end - begin;
+        if (grain == 0) {
+            grain = detail::default_grain(pool, size);
+        }
+        std::vector<value> partial(detail::chunk_count(size, grain), identity);
+        detail::parallel_chunks(pool, size, grain,
+                                [begin, &func, &partial](size_t chunk, size_t first,
+                                                         size_t last) {
+            partial[chunk] = func(begin + first, begin + last);
+        });
+        for (auto &item : partial) {
+            identity = combine(std::move(identity), std::move(item));
+        }
+        return identity;
+    }
+
+    // In place exclusive scan of [first, last) starting from init, returns
+    // the combination of init and all elements. Two passes: every chunk is
+    // reduced, the chunk sums are scanned sequentially, every chunk is
+    // scanned from its offset.
+    template<class iterator, class value, class combiner>
+    value parallel_exclusive_scan(thread_pool &pool, iterator first, iterator last,
+                                  value init, combiner const &combine) {
+        size_t size = static_cast<size_t>(std::distance(first, last));
+        if (size == 0) {
+            return init;
+        }
+        size_t grain = detail::default_grain(pool, size);
+        std::vector<value> sums(detail::chunk_count(size, grain));
+        detail::parallel_chunks(pool, size, grain,
+                                [first, &sums, &combine](size_t chunk, size_t begin,
+                                                         size_t end) {
+            value sum = first[begin];
+            for (size_t i = begin + 1; i < end; ++i) {
+                sum = combine(sum, first[i]);
+            }
+            sums[chunk] = sum;
+        });
+        for (auto &sum : sums) {
+            value current = sum;
+            sum = init;
+            init = combine(init, current);
+        }
+        detail::parallel_chunks(pool, size, grain,
+                                [first, &sums, &combine](size_t chunk, size_t begin,
+                                                         size_t end) {
+            value sum = sums[chunk];
+            for (size_t i = begin; i < end; ++i) {
+                value current = first[i];
+                first[i] = sum;
+                sum = combine(sum, current);
+            }
+        });
+        return init;
+    }
+
+    template<class iterator, class value>
+    value parallel_exclusive_scan(thread_pool &pool, iterator first, iterator last,
+                                  value init) {
+        return parallel_exclusive_scan(pool, first, last, init, std::plus<value>());
+    }
+
+    // Sorts the chunks with std::sort, then merges neighbouring runs in
+    // rounds, the merges of one round run in parallel. Not stable.
+    template<class iterator, class compare>
+    void parallel_sort(thread_pool &pool, iterator first, iterator last,
+                       compare const &less) {
+        size_t size = static_cast<size_t>(std::distance(first, last));
+        if (size < 2) {
+            return;
+        }
+        size_t grain = std::max<size_t>(detail::default_grain(pool, size), 1024);
+        detail::parallel_chunks(pool, size, grain,
+                                [first, &less](size_t, size_t begin, size_t end) {
+            std::sort(first + begin, first + end, less);
+        });
+        for (size_t width = grain; width < size; width *= 2) {
+            size_t merges = detail::chunk_count(size, 2 * width);
+            detail::parallel_chunks(pool, merges, 1,
+                                    [first, size, width, &less](size_t chunk, size_t,
+                                                                size_t) {
+                size_t begin = chunk * 2 * width;
+                size_t middle = std::min(size, begin + width);
+                size_t end = std::min(size, begin + 2 * width);
+                std::inplace_merge(first + begin, first + middle, first + end, less);
+            });
+        }
+    }
+
+    template<class iterator>
+    void parallel_sort(thread_pool &pool, iterator first, iterator last) {
+        parallel_sort(pool, first, last,
+                      std::less<typename std::iterator_traits<iterator>::value_type>());
+    }
+}
+// namespace au
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "mpsc_queue.hpp"
+#include "task.hpp"
+#include "thread_pool.hpp"
+
+
+namespace au {
+namespace detail {
+
+    // Tasks of one strand wait in an MPSC queue; size_ counts the queued
+    // ones plus the running one. The push that raises size_ from zero posts
+    // a drain task to the pool, so at most one drain runs at a time and it
+    // is the only consumer of the queue. A drain the pool refuses (full
+    // queue, stopped pool) or drops unrun discards the queued tasks instead,
+    // their futures get broken_promise and the next push posts a new drain.
+    class strand_state : public std::enable_shared_from_this<strand_state> {
+    public:
+        explicit strand_state(thread_pool &pool) : pool_(pool), size_(0) {}
+
+        ~strand_state() {
+            task *current_task = nullptr;
+            while (queue_.try_pop(current_task)) {
+                current_task->discard();
+            }
+        }
+
+        thread_pool &pool() const {
+            return pool_;
+        }
+
+        void push(task *current_task) {
+            queue_.push(current_task);
+            if (size_.fetch_add(1, std::memory_order_acq_rel) == 0) {
+                schedule();
+            }
+        }
+
+    private:
+        // tasks run by one drain before it makes way for other work
+        static const size_t batch_ = 64;
+
+        // the task is queued already, so a refused post is not rethrown
+        void schedule() {
+            std::shared_ptr<strand_state> self = shared_from_this();
+            try {
+                pool_.post(on_discard([self] {
+                    self->drain();
+                }, [self] {
+                    self->abandon();
+                }));
+            } catch (...) {
+            }
+        }
+
+        void drain() {
+            for (size_t done = 1;; ++done) {
+                task *current_task = nullptr;
+                // counted but not linked yet: its producer is between the
+                // two steps of push
+                while (!queue_.try_pop(current_task)) {
+                    std::this_thread::yield();
+                }
+                current_task->run();
+                if (size_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    return;
+                }
+                if (done == batch_) {
+                    schedule();
+                    return;
+                }
+            }
+        }
+
+        void abandon() {
+            for (;;) {
+                task *current_task = nullptr;
+                while (!queue_.try_pop(current_task)) {
+                    std::this_thread::yield();
+                }
+                current_task->discard();
+                if (size_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    return;
+                }
+            }
+        }
+
+        thread_pool &pool_;
+        mpsc_queue<task *> queue_;
+        std::atomic<size_t> size_;
+    };
+}
+// namespace detail
+
+    // Serial executor on a thread pool: the tasks of a strand run one at a
+    // time, in the order they were posted (from one thread; posts from
+    // different threads are ordered by when they reach the queue), on any
+    // worker of the pool. Different strands run in parallel. Posting is
+    // lock-free, and no thread is held while a strand is empty. Copies
+    // share the queue. A strand runs at most 64 tasks in a row before it
+    // requeues itself behind other work of the pool.
+    class strand {
+    public:
+        explicit strand(thread_pool &pool) :
+                state_(std::make_shared<detail::strand_state>(pool)) {}
+
+        // an exception thrown by func goes to the exception handler of the
+        // pool
+        template<class function>
+        void post(function &&func) {
+            thread_pool *pool = &state_->pool();
+            state_->push(detail::task::make([pool, call = std::forward<function>(func)]() mutable {
+                try {
+                    call();
+                } catch (...) {
+                    pool->handle_exception(std::current_exception());
+                }
+            }));
+        }
+
+        template<class function, class... argument>
+        auto submit(function &&func, argument &&... args)
+        -> std::future<detail::result_of_t<function, argument...>> {
+            typedef detail::result_of_t<function, argument...> result_type;
+            std::promise<result_type> promise(std::allocator_arg,
+                                              detail::pool_allocator<result_type>());
+            std::future<result_type> result = promise.get_future();
+            state_->push(detail::make_promise_task(std::move(promise),
+                                                   std::forward<function>(func),
+                                                   std::forward<argument>(args)...));
+            return result;
+        }
+
+    private:
+        std::shared_ptr<detail::strand_state> state_;
+    };
+
+    // Tasks with equal keys run serially in submission order, tasks with
+    // different keys usually in parallel: every key maps by its hash to one
+    // of a fixed number of strands, so there is no state (and no mutex) per
+    // key. Keys sharing a strand are serialized with each other too; more
+    // strands make that rarer.
+    template<class key, class hash = std::hash<key>>
+    class keyed_executor {
+    public:
+        explicit keyed_executor(thread_pool &pool, size_t strands_count = 64,
+                                hash const &hasher = hash()) : hash_(hasher) {
+            if (strands_count == 0) {
+                throw std::invalid_argument("keyed_executor: no strands");
+            }
+            strands_.reserve(strands_count);
+            for (size_t i = 0; i < strands_count; ++i) {
+                strands_.emplace_back(pool);
+            }
+        }
+
+        strand &at(key const &value) {
+            return strands_[hash_(value) % strands_.size()];
+        }
+
+        template<class function>
+        void post(key const &value, function &&func) {
+            at(value).post(std::forward<function>(func));
+        }
+
+        template<class function, class... argument>
+        auto submit(key const &value, function &&func, argument &&... args)
+        -> std::future<detail::result_of_t<function, argument...>> {
+            return at(value).submit(std::forward<function>(func),
+                                    std::forward<argument>(args)...);
+        }
+
+    private:
+        hash hash_;
+        std::vector<strand> strands_;
+    };
+}
+// namespace au
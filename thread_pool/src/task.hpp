@@ -0,0 +1,340 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "block_pool.hpp"
+#include "cancellation.hpp"
+
+
+namespace au {
+namespace detail {
+
+    // std::result_of is gone in C++20
+#if defined(__cpp_lib_is_invocable)
+    template<class function, class... argument>
+    using result_of_t = typename std::invoke_result<
+            typename std::decay<function>::type,
+            typename std::decay<argument>::type...>::type;
+#else
+    template<class function, class... argument>
+    using result_of_t = typename std::result_of<
+            typename std::decay<function>::type(
+                    typename std::decay<argument>::type...)>::type;
+#endif
+
+    // INVOKE from [func.require], enough of it for what std::bind accepted
+    template<class function, class... argument>
+    auto invoke(function &&func, argument &&... args)
+    -> decltype(std::forward<function>(func)(std::forward<argument>(args)...)) {
+        return std::forward<function>(func)(std::forward<argument>(args)...);
+    }
+
+    template<class result, class owner, class object, class... argument>
+    auto invoke(result owner::*method, object &&self, argument &&... args)
+    -> decltype((std::forward<object>(self).*method)(std::forward<argument>(args)...)) {
+        return (std::forward<object>(self).*method)(std::forward<argument>(args)...);
+    }
+
+    template<class result, class owner, class object, class... argument>
+    auto invoke(result owner::*method, object &&self, argument &&... args)
+    -> decltype(((*std::forward<object>(self)).*method)(std::forward<argument>(args)...)) {
+        return ((*std::forward<object>(self)).*method)(std::forward<argument>(args)...);
+    }
+
+    // callables with a cancelled() member tell a queued task it need not
+    // run, see cancellable_call
+    template<class function, class = void>
+    struct cancel_check {
+        static bool cancelled(function const &) {
+            return false;
+        }
+    };
+
+    template<class function>
+    struct cancel_check<function, typename function::cancellable> {
+        static bool cancelled(function const &func) {
+            return func.cancelled();
+        }
+    };
+
+    // Type erased, move-only unit of work. The callable is stored in the same
+    // block as the task header; blocks come from block_pool, so running small
+    // tasks does not touch the heap. A task is consumed exactly once, either
+    // by run() or by discard() (the callable is destroyed without running).
+    class task {
+    public:
+        task(task const &) = delete;
+
+        task &operator=(task const &) = delete;
+
+        template<class function>
+        static task *make(function &&func);
+
+        void run() {
+            manage_(this, action::run);
+        }
+
+        void discard() {
+            manage_(this, action::discard);
+        }
+
+        // true if running the task would only report its cancellation; the
+        // task stays alive
+        bool cancelled() {
+            return manage_(this, action::poll);
+        }
+
+    protected:
+        enum class action {
+            run, discard, poll
+        };
+
+        typedef bool (*manager)(task *, action);
+
+        explicit task(manager manage) : manage_(manage) {}
+
+        ~task() = default;
+
+    private:
+        manager manage_;
+    };
+
+    template<class function>
+    class task_impl : public task {
+    public:
+        template<class callable>
+        explicit task_impl(callable &&func) :
+                task(&task_impl::manage), func_(std::forward<callable>(func)) {}
+
+    private:
+        static bool manage(task *base, action what) {
+            task_impl *self = static_cast<task_impl *>(base);
+            if (what == action::poll) {
+                return cancel_check<function>::cancelled(self->func_);
+            }
+            struct release {
+                ~release() {
+                    self_->~task_impl();
+                    pooled_deallocate(self_, sizeof(task_impl));
+                }
+                task_impl *self_;
+            } guard{self};
+            if (what == action::run) {
+                self->func_();
+            }
+            return false;
+        }
+
+        function func_;
+    };
+
+    template<class function>
+    task *task::make(function &&func) {
+        typedef task_impl<typename std::decay<function>::type> impl;
+        static_assert(alignof(impl) <= alignof(std::max_align_t),
+                      "over-aligned callables are not supported");
+        void *memory = pooled_allocate(sizeof(impl));
+        try {
+            return new(memory) impl(std::forward<function>(func));
+        } catch (...) {
+            pooled_deallocate(memory, sizeof(impl));
+            throw;
+        }
+    }
+
+    // a callable with its decayed arguments, called once with the
+    // arguments moved in
+    template<class function, class... argument>
+    class bound_call {
+    public:
+        typedef decltype(detail::invoke(std::declval<function>(),
+                                        std::declval<argument>()...)) result;
+
+        explicit bound_call(function func, argument... args) :
+                func_(std::move(func)), args_(std::move(args)...) {}
+
+        result operator()() {
+            return call(std::index_sequence_for<argument...>());
+        }
+
+    private:
+        template<size_t... index>
+        result call(std::index_sequence<index...>) {
+            return detail::invoke(std::move(func_), std::get<index>(std::move(args_))...);
+        }
+
+        function func_;
+        std::tuple<argument...> args_;
+    };
+
+    template<class function, class... argument>
+    bound_call<typename std::decay<function>::type, typename std::decay<argument>::type...>
+    bind_call(function &&func, argument &&... args) {
+        return bound_call<typename std::decay<function>::type,
+                typename std::decay<argument>::type...>(
+                std::forward<function>(func), std::forward<argument>(args)...);
+    }
+
+    template<class result>
+    struct promise_setter {
+        template<class function>
+        static void set(std::promise<result> &promise, function &&func) {
+            promise.set_value(func());
+        }
+    };
+
+    template<>
+    struct promise_setter<void> {
+        template<class function>
+        static void set(std::promise<void> &promise, function &&func) {
+            func();
+            promise.set_value();
+        }
+    };
+
+    // callable stored in the task of thread_pool::submit: the decayed
+    // function and arguments, moved into the call, and the promise
+    template<class result, class function, class... argument>
+    class promise_call {
+    public:
+        template<class callable, class... values>
+        promise_call(std::promise<result> &&promise, callable &&func, values &&... args) :
+                promise_(std::move(promise)), func_(std::forward<callable>(func)),
+                args_(std::forward<values>(args)...) {}
+
+        void operator()() {
+            try {
+                promise_setter<result>::set(promise_, [this] {
+                    return call(std::index_sequence_for<argument...>());
+                });
+            } catch (...) {
+                promise_.set_exception(std::current_exception());
+            }
+        }
+
+        // completes the promise without calling the function
+        void fail(std::exception_ptr error) {
+            promise_.set_exception(std::move(error));
+        }
+
+    private:
+        template<size_t... index>
+        result call(std::index_sequence<index...>) {
+            return detail::invoke(std::move(func_), std::get<index>(std::move(args_))...);
+        }
+
+        std::promise<result> promise_;
+        function func_;
+        std::tuple<argument...> args_;
+    };
+
+    template<class result, class function, class... argument>
+    task *make_promise_task(std::promise<result> &&promise, function &&func,
+                            argument &&... args) {
+        typedef promise_call<result, typename std::decay<function>::type,
+                typename std::decay<argument>::type...> call;
+        return task::make(call(std::move(promise), std::forward<function>(func),
+                               std::forward<argument>(args)...));
+    }
+
+    // what a std::promise destroyed unsatisfied leaves in its future
+    inline std::exception_ptr broken_promise() {
+        return std::make_exception_ptr(std::future_error(std::future_errc::broken_promise));
+    }
+
+    // Callable for a pool that may drop it: if it is destroyed without being
+    // called (the pool was destroyed with the task queued, or refused it),
+    // fallback runs instead, so whoever waits for the result learns about it
+    // like from a broken std::promise. Move-only, a moved-from guard is
+    // disarmed.
+    template<class function, class fallback>
+    class discard_guard {
+    public:
+        discard_guard(function func, fallback on_drop) :
+                func_(std::move(func)), fallback_(std::move(on_drop)), armed_(true) {}
+
+        discard_guard(discard_guard &&other) :
+                func_(std::move(other.func_)), fallback_(std::move(other.fallback_)),
+                armed_(other.armed_) {
+            other.armed_ = false;
+        }
+
+        discard_guard(discard_guard const &) = delete;
+
+        discard_guard &operator=(discard_guard const &) = delete;
+
+        ~discard_guard() {
+            if (armed_) {
+                try {
+                    fallback_();
+                } catch (...) {
+                }
+            }
+        }
+
+        void operator()() {
+            armed_ = false;
+            func_();
+        }
+
+    private:
+        function func_;
+        fallback fallback_;
+        bool armed_;
+    };
+
+    template<class function, class fallback>
+    discard_guard<typename std::decay<function>::type, typename std::decay<fallback>::type>
+    on_discard(function &&func, fallback &&on_drop) {
+        return discard_guard<typename std::decay<function>::type,
+                typename std::decay<fallback>::type>(std::forward<function>(func),
+                                                     std::forward<fallback>(on_drop));
+    }
+
+    // a promise_call skipped once its token is cancelled: the promise gets
+    // task_cancelled instead, nothing is thrown
+    template<class call>
+    class cancellable_call {
+    public:
+        typedef void cancellable;
+
+        cancellable_call(cancellation_token token, call &&func) :
+                token_(std::move(token)), call_(std::move(func)) {}
+
+        bool cancelled() const {
+            return token_.cancelled();
+        }
+
+        void operator()() {
+            if (cancelled()) {
+                call_.fail(std::make_exception_ptr(task_cancelled()));
+            } else {
+                call_();
+            }
+        }
+
+    private:
+        cancellation_token token_;
+        call call_;
+    };
+
+    template<class result, class function, class... argument>
+    task *make_cancellable_task(cancellation_token token, std::promise<result> &&promise,
+                                function &&func, argument &&... args) {
+        typedef promise_call<result, typename std::decay<function>::type,
+                typename std::decay<argument>::type...> call;
+        return task::make(cancellable_call<call>(
+                std::move(token), call(std::move(promise), std::forward<function>(func),
+                                       std::forward<argument>(args)...)));
+    }
+}
+// namespace detail
+}
+// namespace au
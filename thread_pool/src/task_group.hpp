@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "cancellation.hpp"
+#include "thread_pool.hpp"
+
+
+namespace au {
+
+    // Fork-join without futures: run() posts tasks to the pool, wait()
+    // returns when all of them finished, helping to run tasks of the pool
+    // meanwhile, and rethrows the first exception of the group. An exception
+    // or cancel() skips the tasks of the group that have not started yet;
+    // running tasks may poll token(). After wait() the group can be reused.
+    // The destructor waits for the tasks still running, without throwing.
+    // A task the pool drops unrun (it is destroyed first) fails the group
+    // with std::future_error(broken_promise); wait() then needs no pool.
+    class task_group {
+    public:
+        explicit task_group(thread_pool &pool) :
+                pool_(pool), state_(std::make_shared<state>()) {}
+
+        task_group(task_group const &) = delete;
+
+        task_group &operator=(task_group const &) = delete;
+
+        ~task_group() {
+            try {
+                wait();
+            } catch (...) {
+            }
+        }
+
+        template<class function>
+        void run(function &&func) {
+            std::shared_ptr<state> current = state_;
+            cancellation_token token = current->source_.token();
+            auto body = [current, token, call = std::forward<function>(func)]() mutable {
+                if (!token.cancelled()) {
+                    try {
+                        call();
+                    } catch (...) {
+                        current->fail(std::current_exception());
+                    }
+                }
+                current->finish();
+            };
+            current->pending_.fetch_add(1);
+            // a task refused or dropped by the pool still finishes, failing
+            // the group; the exception of a refusing post goes on to the caller
+            pool_.post(detail::on_discard(std::move(body), [current] {
+                current->fail(detail::broken_promise());
+                current->finish();
+            }));
+        }
+
+        void wait() {
+            std::shared_ptr<state> current = state_;
+            if (current->pending_.load() == 0) {
+                finish_wait(current);
+                return;
+            }
+            pool_.help_until([&current] {
+                return current->pending_.load() == 0;
+            }, [&current](std::chrono::microseconds pause) {
+                std::unique_lock<std::mutex> lock(current->mutex_);
+                current->done_.wait_for(lock, pause, [&current] {
+                    return current->pending_.load() == 0;
+                });
+            });
+            finish_wait(current);
+        }
+
+        void cancel() {
+            state_->source_.cancel();
+        }
+
+        bool is_cancelled() const {
+            return state_->source_.cancelled();
+        }
+
+        cancellation_token token() const {
+            return state_->source_.token();
+        }
+
+    private:
+        // shared with the posted tasks: the last one still notifies after
+        // the count dropped to zero and wait() may have returned
+        struct state {
+            void fail(std::exception_ptr error) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (!error_) {
+                        error_ = error;
+                    }
+                }
+                source_.cancel();
+            }
+
+            void finish() {
+                if (pending_.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    done_.notify_all();
+                }
+            }
+
+            std::atomic<size_t> pending_{0};
+            cancellation_source source_;
+            std::exception_ptr error_;
+            std::mutex mutex_;
+            std::condition_variable done_;
+        };
+
+        // resets the group for reuse, rethrows its first exception
+        void finish_wait(std::shared_ptr<state> const &current) {
+            std::exception_ptr error = current->error_;
+            state_ = std::make_shared<state>();
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        thread_pool &pool_;
+        std::shared_ptr<state> state_;
+    };
+}
+// namespace au
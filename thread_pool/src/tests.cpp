@@ -1,6 +1,13 @@
 #include "thread_pool.hpp"
+#include "parallel.hpp"
+#include "future.hpp"
+#include "task_group.hpp"
+#include "strand.hpp"
+#include "coroutine.hpp"
 #include "catch.hpp"
 
+#include <thread>
+
 using au::thread_pool;
 
 
@@ -51,6 +58,22 @@ TEST_CASE("recursive submit, set_thread_count") {
     CHECK(tp.threads_count() == 25); // fix
 }
 
+TEST_CASE("add_threads from concurrent tasks adds up") {
+    thread_pool tp(4, 64);
+    std::vector<std::future<size_t>> grown;
+    for (size_t i = 0; i < 16; ++i) {
+        grown.push_back(tp.submit([&tp] { return tp.add_threads(2); }));
+    }
+    for (auto &result : grown) {
+        result.get();
+    }
+    CHECK(tp.threads_count() == 36);
+    CHECK(tp.add_threads(-30) == 6);
+    CHECK(tp.threads_count() == 6);
+    CHECK_THROWS(tp.add_threads(-6));
+    CHECK(tp.threads_count() == 6);
+}
+
 
 // нетривиальный тест
 TEST_CASE("test blocking queue") {
@@ -99,6 +122,1086 @@ TEST_CASE("test blocking queue") {
     CHECK(wait_over == true);
 }
 
+// нетривиальный тест
+TEST_CASE("tasks submitted from a worker are stolen by idle workers") {
+    thread_pool tp(4, 4);
+    std::atomic<size_t> arrived(0);
+    tp.submit([&tp, &arrived] {
+        std::vector<std::future<void>> parts;
+        for (size_t idx = 0; idx < 3; ++idx) {
+            parts.push_back(tp.submit([&arrived] {
+                ++arrived;
+                while (arrived < 3) {
+                    std::this_thread::yield();
+                }
+            }));
+        }
+        for (auto &part : parts) {
+            part.get();
+        }
+    }).get();
+    CHECK(arrived == 3);
+}
+
+
+// нетривиальный тест
+TEST_CASE("many nested submits from workers") {
+    thread_pool tp(4, 8);
+    std::atomic<size_t> done(0);
+    std::vector<std::future<void>> roots;
+    for (size_t idx = 0; idx < 2; ++idx) {
+        roots.push_back(tp.submit([&tp, &done] {
+            std::vector<std::future<void>> leaves;
+            for (size_t leaf = 0; leaf < 1000; ++leaf) {
+                leaves.push_back(tp.submit([&done] { ++done; }));
+            }
+            for (auto &item : leaves) {
+                item.get();
+            }
+        }));
+    }
+    for (auto &item : roots) {
+        item.get();
+    }
+    CHECK(done == 2000);
+}
+
+// нетривиальный тест
+TEST_CASE("raising max queue size releases blocked submit") {
+    thread_pool tp(1, 1);
+    std::mutex mutex;
+    mutex.lock();
+    tp.submit([&mutex] { std::unique_lock<std::mutex> lock(mutex); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    tp.submit([] {});
+
+    std::atomic_bool submitted(false);
+    std::thread wait_submit([&tp, &submitted] {
+        tp.submit([] {});
+        submitted = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(submitted == false);
+    tp.set_max_queue_size(4);
+    wait_submit.join();
+    CHECK(submitted == true);
+    mutex.unlock();
+}
+
+
+// нетривиальный тест
+TEST_CASE("bounded queue under concurrent producers and consumers") {
+    au::detail::bounded_queue<size_t> queue(8);
+    const size_t per_producer = 20000;
+    std::atomic<size_t> sum(0);
+    std::atomic<size_t> popped(0);
+    std::atomic_bool over_limit(false);
+    std::vector<std::thread> threads;
+    for (size_t producer = 0; producer < 3; ++producer) {
+        threads.emplace_back([&queue, &per_producer] {
+            for (size_t value = 1; value <= per_producer; ++value) {
+                while (!queue.try_push(value)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (size_t consumer = 0; consumer < 3; ++consumer) {
+        threads.emplace_back([&queue, &sum, &popped, &over_limit, &per_producer] {
+            size_t value = 0;
+            while (popped < 3 * per_producer) {
+                if (queue.try_pop(value)) {
+                    if (queue.size() > 64) {
+                        over_limit = true;
+                    }
+                    sum += value;
+                    ++popped;
+                }
+            }
+        });
+    }
+    threads.emplace_back([&queue] {
+        for (size_t limit = 8; limit <= 64; limit *= 2) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            queue.set_limit(limit);
+        }
+    });
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    CHECK(sum == 3 * per_producer * (per_producer + 1) / 2);
+    CHECK(queue.empty());
+    CHECK(over_limit == false);
+}
+
+TEST_CASE("submit forwards move-only arguments and member functions") {
+    au::thread_pool pool(2, 4);
+    std::unique_ptr<int> value(new int(41));
+    auto moved = pool.submit([](std::unique_ptr<int> pointer) {
+        return *pointer + 1;
+    }, std::move(value));
+    CHECK(moved.get() == 42);
+
+    std::vector<int> numbers{1, 2, 3};
+    auto size = pool.submit(&std::vector<int>::size, &numbers);
+    CHECK(size.get() == 3);
+
+    auto failed = pool.submit([] { throw std::logic_error("task"); });
+    CHECK_THROWS(failed.get());
+}
+
+TEST_CASE("post runs tasks without futures and reports exceptions") {
+    au::thread_pool pool(3, 16);
+    std::atomic<size_t> sum(0);
+    std::atomic<size_t> failures(0);
+    pool.set_exception_handler([&failures](std::exception_ptr) {
+        ++failures;
+    });
+    pool.post_n(100, [&sum](size_t index) {
+        sum += index;
+    });
+    for (size_t i = 0; i < 10; ++i) {
+        pool.post([] { throw std::runtime_error("posted"); });
+    }
+    while (sum < 4950 || failures < 10) {
+        std::this_thread::yield();
+    }
+    CHECK(sum == 4950);
+    CHECK(failures == 10);
+}
+
+TEST_CASE("batch submit through a small queue and from a worker") {
+    au::thread_pool pool(4, 16);
+    auto squares = pool.submit_n(10000, [](size_t i) {
+        return i * i;
+    });
+    size_t sum = 0;
+    for (auto &square : squares) {
+        sum += square.get();
+    }
+    CHECK(sum == 333283335000);
+
+    std::vector<std::function<int()>> functions;
+    for (int i = 0; i < 100; ++i) {
+        functions.push_back([i] { return i; });
+    }
+    auto nested = pool.submit([&pool, &functions] {
+        auto values = pool.submit_bulk(functions.begin(), functions.end());
+        int total = 0;
+        for (auto &value : values) {
+            total += value.get();
+        }
+        return total;
+    });
+    CHECK(nested.get() == 4950);
+}
+
+TEST_CASE("parallel for, reduce, scan and sort") {
+    au::thread_pool pool(4, 16);
+    std::vector<size_t> values(100000);
+    au::parallel_for(pool, 0, values.size(), [&values](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            values[i] = (i * 7919) % 1000;
+        }
+    });
+    size_t expected = 0;
+    for (auto value : values) {
+        expected += value;
+    }
+    size_t sum = au::parallel_reduce(pool, 0, values.size(), 1000, size_t(0),
+                                     [&values](size_t begin, size_t end) {
+        size_t local = 0;
+        for (size_t i = begin; i < end; ++i) {
+            local += values[i];
+        }
+        return local;
+    }, std::plus<size_t>());
+    CHECK(sum == expected);
+
+    std::vector<size_t> prefix = values;
+    CHECK(au::parallel_exclusive_scan(pool, prefix.begin(), prefix.end(), size_t(0)) == expected);
+    CHECK(prefix[0] == 0);
+    CHECK(prefix.back() + values.back() == expected);
+
+    au::parallel_sort(pool, values.begin(), values.end());
+    CHECK(std::is_sorted(values.begin(), values.end()));
+
+    // nested from a worker of the same pool, and exceptions reach the caller
+    auto nested = pool.submit([&pool] {
+        return au::parallel_reduce(pool, 0, 1000, 10, 0, [](size_t begin, size_t end) {
+            return int(end - begin);
+        }, std::plus<int>());
+    });
+    CHECK(nested.get() == 1000);
+    CHECK_THROWS(au::parallel_for(pool, 0, 100, 1, [](size_t begin, size_t) {
+        if (begin == 50) {
+            throw std::runtime_error("chunk");
+        }
+    }));
+}
+
+TEST_CASE("parallel for finishes the chunks when the helpers are refused") {
+    au::thread_pool pool(2, 2);
+    pool.set_backpressure(au::backpressure{au::overflow_policy::reject});
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked[2];
+    for (auto &item : blocked) {
+        pool.post([opened, &item] {
+            item.set_value();
+            opened.wait();
+        });
+    }
+    for (auto &item : blocked) {
+        item.get_future().wait();
+    }
+    // one free slot: the first helper is queued, the second one is refused
+    auto queued = pool.submit([] { return 1; });
+
+    std::vector<size_t> values(100, 0);
+    CHECK_THROWS_AS(au::parallel_for(pool, 0, values.size(), 10,
+                                     [&values](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            values[i] = i;
+        }
+    }), au::queue_full const &);
+    for (size_t i = 0; i < values.size(); ++i) {
+        CHECK(values[i] == i);
+    }
+    gate.set_value();
+    CHECK(queued.get() == 1);
+    pool.wait_idle();
+}
+
+// нетривиальный тест
+TEST_CASE("recursive submit on a fixed thread count") {
+    thread_pool tp(2, 4);
+    std::function<size_t(size_t)> fib;
+    fib = [&tp, &fib](size_t n) -> size_t {
+        if (n <= 1) {
+            return 1;
+        }
+        auto res1 = tp.submit(fib, n - 1);
+        auto res2 = tp.submit(fib, n - 2);
+        return tp.get(res1) + tp.get(res2);
+    };
+    CHECK(tp.get(tp.submit(fib, 18)) == 4181);
+    CHECK(tp.threads_count() == 2);
+}
+
+// нетривиальный тест
+TEST_CASE("set_thread_count while tasks run, also from a task") {
+    thread_pool tp(4, 64);
+    std::atomic<size_t> done(0);
+    std::vector<std::future<void>> results;
+    for (size_t i = 0; i < 2000; ++i) {
+        results.push_back(tp.submit([&tp, &done, i] {
+            if (i % 100 == 0) {
+                tp.set_threads_count(1 + i / 100 % 4);
+            }
+            ++done;
+        }));
+        if (i % 250 == 0) {
+            tp.set_threads_count(1 + i / 250 % 3);
+        }
+    }
+    for (auto &result : results) {
+        result.get();
+    }
+    CHECK(done == 2000);
+    tp.set_threads_count(1);
+    CHECK(tp.submit([] { return 7; }).get() == 7);
+    CHECK(tp.threads_count() == 1);
+}
+
+TEST_CASE("autoscaling target follows delay and utilization") {
+    au::autoscale_options options;
+    options.min_threads = 2;
+    options.max_threads = 16;
+    au::detail::load_estimate busy;
+    busy.utilization = 1;
+    busy.delay_us = 5000;
+    CHECK(au::detail::autoscale_target(options, 8, 4, busy) == 5);
+    CHECK(au::detail::autoscale_target(options, 8, 8, busy) == 8);
+    CHECK(au::detail::autoscale_target(options, 4, 8, busy) == 4);
+
+    au::detail::load_estimate idle;
+    CHECK(au::detail::autoscale_target(options, 8, 4, idle) == 3);
+    CHECK(au::detail::autoscale_target(options, 8, 2, idle) == 2);
+
+    au::detail::load_estimate steady;
+    steady.utilization = 0.7;
+    CHECK(au::detail::autoscale_target(options, 8, 4, steady) == 4);
+}
+
+TEST_CASE("autoscaling shrinks an idle pool to the lower bound") {
+    au::thread_pool pool(3, 16);
+    au::autoscale_options options;
+    options.min_threads = 1;
+    options.max_threads = 3;
+    options.period = std::chrono::milliseconds(2);
+    pool.enable_autoscaling(options);
+    for (size_t i = 0; i < 1000 && pool.threads_count() > 1; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    CHECK(pool.threads_count() == 1);
+    CHECK(pool.submit([] { return 1; }).get() == 1);
+    pool.disable_autoscaling();
+}
+
+TEST_CASE("high priority tasks overtake queued batch work") {
+    au::thread_pool pool(1, 16);
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    pool.post([opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+    });
+    blocked.get_future().wait();
+
+    std::mutex mutex;
+    std::vector<int> order;
+    auto record = [&mutex, &order](int value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(value);
+    };
+    std::vector<std::future<void>> results;
+    for (int i = 0; i < 6; ++i) {
+        results.push_back(pool.submit(au::priority::low, record, 0));
+    }
+    for (int i = 0; i < 2; ++i) {
+        results.push_back(pool.submit(au::priority::high, record, 1));
+    }
+    gate.set_value();
+    for (auto &result : results) {
+        result.get();
+    }
+    REQUIRE(order.size() == 8);
+    CHECK(std::count(order.begin(), order.begin() + 3, 1) == 2);
+}
+
+TEST_CASE("deadline tasks run earliest deadline first, late ones are dropped") {
+    au::thread_pool pool(1, 16);
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    pool.post([opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+    });
+    blocked.get_future().wait();
+
+    std::mutex mutex;
+    std::vector<int> order;
+    auto record = [&mutex, &order](int value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(value);
+        return value;
+    };
+    auto now = std::chrono::steady_clock::now();
+    pool.set_deadline_policy(au::deadline_policy::drop);
+    auto late = pool.submit_with_deadline(now - std::chrono::seconds(1), record, 0);
+    auto third = pool.submit_with_deadline(now + std::chrono::hours(3), record, 3);
+    auto first = pool.submit_with_deadline(now + std::chrono::hours(1), record, 1);
+    auto plain = pool.submit(record, 4);
+    auto second = pool.submit_with_deadline(now + std::chrono::hours(2), record, 2);
+    gate.set_value();
+
+    CHECK_THROWS_AS(late.get(), au::deadline_missed const &);
+    CHECK(third.get() == 3);
+    CHECK(plain.get() == 4);
+    // the far deadlines wait for the lanes
+    CHECK(order == std::vector<int>({4, 1, 2, 3}));
+    CHECK(first.get() + second.get() == 3);
+    CHECK(pool.missed_deadlines() == 1);
+}
+
+TEST_CASE("due deadline tasks go before the lanes, far ones after them") {
+    au::thread_pool pool(1, 16);
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    pool.post([opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+    });
+    blocked.get_future().wait();
+
+    std::mutex mutex;
+    std::vector<int> order;
+    auto record = [&mutex, &order](int value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(value);
+        return value;
+    };
+    auto now = std::chrono::steady_clock::now();
+    auto plain = pool.submit(record, 1);
+    auto far = pool.submit_with_deadline(now + std::chrono::hours(1), record, 3);
+    auto due = pool.submit_with_deadline(now, record, 0);
+    auto other = pool.submit(record, 2);
+    gate.set_value();
+
+    CHECK(far.get() == 3);
+    CHECK(due.get() + plain.get() + other.get() == 3);
+    CHECK(order == std::vector<int>({0, 1, 2, 3}));
+}
+
+TEST_CASE("cancelled tasks are skipped, running ones can poll the token") {
+    au::thread_pool pool(1, 128);
+    au::cancellation_source source;
+    std::promise<void> started;
+    std::atomic<size_t> polls(0);
+    auto running = pool.submit(source.token(), [&started, &polls](au::cancellation_token token) {
+        started.set_value();
+        while (!token.cancelled()) {
+            ++polls;
+            std::this_thread::yield();
+        }
+        token.throw_if_cancelled();
+    }, source.token());
+    started.get_future().wait();
+
+    std::atomic<size_t> ran(0);
+    std::vector<std::future<void>> queued;
+    for (size_t i = 0; i < 100; ++i) {
+        queued.push_back(pool.submit(source.token(), [&ran] { ++ran; }));
+    }
+    auto other = pool.submit([] { return 5; });
+    source.cancel();
+
+    CHECK_THROWS_AS(running.get(), au::task_cancelled const &);
+    for (auto &result : queued) {
+        CHECK_THROWS_AS(result.get(), au::task_cancelled const &);
+    }
+    CHECK(ran == 0);
+    CHECK(other.get() == 5);
+}
+
+TEST_CASE("cancelled tasks give their queue slots back to producers") {
+    au::thread_pool pool(1, 4);
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    pool.post([opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+    });
+    blocked.get_future().wait();
+
+    au::cancellation_source source;
+    std::atomic<size_t> ran(0);
+    std::vector<std::future<void>> queued;
+    for (size_t i = 0; i < 4; ++i) {
+        queued.push_back(pool.submit(source.token(), [&ran] { ++ran; }));
+    }
+    au::backpressure reject{au::overflow_policy::reject};
+    CHECK_THROWS_AS(pool.submit(reject, [] { return 0; }), au::queue_full const &);
+
+    source.cancel();
+    auto live = pool.submit(reject, [] { return 5; });
+    // completed by the producer, the worker is still blocked
+    for (auto &result : queued) {
+        CHECK(result.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        CHECK_THROWS_AS(result.get(), au::task_cancelled const &);
+    }
+    gate.set_value();
+    CHECK(live.get() == 5);
+    CHECK(ran == 0);
+}
+
+TEST_CASE("backpressure policies on a full queue") {
+    au::thread_pool pool(1, 2);
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    pool.post([opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+    });
+    blocked.get_future().wait();
+    auto oldest = pool.submit([] { return 1; });
+    auto newer = pool.submit([] { return 2; });
+
+    au::backpressure reject{au::overflow_policy::reject};
+    CHECK_THROWS_AS(pool.submit(reject, [] { return 3; }), au::queue_full const &);
+
+    au::backpressure timeout{au::overflow_policy::block_for, std::chrono::milliseconds(5)};
+    auto before = std::chrono::steady_clock::now();
+    CHECK_THROWS_AS(pool.submit(timeout, [] { return 4; }), au::queue_full const &);
+    CHECK(std::chrono::steady_clock::now() - before >= std::chrono::milliseconds(5));
+
+    au::backpressure inline_run{au::overflow_policy::caller_runs};
+    auto caller = pool.submit(inline_run, [] { return std::this_thread::get_id(); });
+    CHECK(caller.get() == std::this_thread::get_id());
+
+    pool.set_backpressure(au::backpressure{au::overflow_policy::drop_oldest});
+    auto latest = pool.submit([] { return 5; });
+    gate.set_value();
+    CHECK_THROWS_AS(oldest.get(), std::future_error const &);
+    CHECK(newer.get() == 2);
+    CHECK(latest.get() == 5);
+}
+
+TEST_CASE("future continuations, when_all and when_any") {
+    au::thread_pool pool(2, 16);
+    auto chained = au::spawn(pool, [](int value) { return value * 2; }, 20)
+            .then([](int value) { return value + 2; })
+            .then([](int value) { return std::to_string(value); });
+    CHECK(chained.get() == "42");
+
+    auto failed = au::spawn(pool, [] { throw std::runtime_error("stage"); })
+            .then([] { return 1; });
+    CHECK_THROWS_AS(failed.get(), std::runtime_error const &);
+
+    std::vector<au::future<size_t>> parts;
+    for (size_t i = 0; i < 10; ++i) {
+        parts.push_back(au::spawn(pool, [i] { return i * i; }));
+    }
+    auto total = au::when_all(parts).then([](std::vector<size_t> const &values) {
+        size_t sum = 0;
+        for (auto value : values) {
+            sum += value;
+        }
+        return sum;
+    });
+    CHECK(total.get() == 285);
+
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    std::vector<au::future<int>> racing;
+    racing.push_back(au::spawn(pool, [opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+        return 0;
+    }));
+    blocked.get_future().wait();
+    racing.push_back(au::spawn(pool, [] { return 1; }));
+    CHECK(au::when_any(racing).get() == 1);
+    gate.set_value();
+    CHECK(racing[0].get() == 0);
+}
+
+TEST_CASE("futures of tasks dropped with their pool report broken_promise") {
+    std::unique_ptr<au::thread_pool> pool(new au::thread_pool(1, 16));
+    auto ready = au::spawn(*pool, [] { return 1; });
+    ready.wait();
+
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    pool->post([opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+    });
+    blocked.get_future().wait();
+    auto queued = au::spawn(*pool, [] { return 2; });
+    auto chained = queued.then([](int value) { return value + 1; });
+    auto continued = ready.then([](int value) { return value + 1; });
+
+    // the worker finishes the gate task only once the pool is stopping
+    std::thread destroyer([&pool] {
+        pool.reset();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    gate.set_value();
+    destroyer.join();
+
+    CHECK(ready.get() == 1);
+    CHECK_THROWS_AS(queued.get(), std::future_error const &);
+    CHECK_THROWS_AS(chained.get(), std::future_error const &);
+    CHECK_THROWS_AS(continued.get(), std::future_error const &);
+}
+
+TEST_CASE("task group waits, cancels and reports the first exception") {
+    au::thread_pool pool(2, 64);
+    std::atomic<size_t> sum(0);
+    {
+        au::task_group group(pool);
+        for (size_t i = 1; i <= 100; ++i) {
+            group.run([&sum, i] { sum += i; });
+        }
+        group.wait();
+        CHECK(sum == 5050);
+
+        // nested groups inside tasks of the same pool
+        for (size_t i = 0; i < 4; ++i) {
+            group.run([&pool, &sum] {
+                au::task_group inner(pool);
+                for (size_t j = 0; j < 10; ++j) {
+                    inner.run([&sum] { ++sum; });
+                }
+                inner.wait();
+            });
+        }
+        group.wait();
+        CHECK(sum == 5090);
+    }
+
+    au::task_group group(pool);
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::atomic<size_t> started(0);
+    for (size_t i = 0; i < 50; ++i) {
+        group.run([opened, &started] {
+            ++started;
+            opened.wait();
+        });
+    }
+    group.cancel();
+    gate.set_value();
+    group.wait();
+    CHECK(started < 50);
+
+    group.run([] { throw std::runtime_error("first"); });
+    CHECK_THROWS_AS(group.wait(), std::runtime_error const &);
+    CHECK(group.is_cancelled() == false);
+}
+
+TEST_CASE("a task group fails with broken_promise when its pool drops its tasks") {
+    std::unique_ptr<au::thread_pool> pool(new au::thread_pool(1, 16));
+    au::task_group group(*pool);
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    pool->post([opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+    });
+    blocked.get_future().wait();
+    std::atomic<size_t> ran(0);
+    for (size_t i = 0; i < 3; ++i) {
+        group.run([&ran] { ++ran; });
+    }
+
+    std::thread destroyer([&pool] {
+        pool.reset();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    gate.set_value();
+    destroyer.join();
+
+    CHECK_THROWS_AS(group.wait(), std::future_error const &);
+    CHECK(ran == 0);
+}
+
+TEST_CASE("wait_idle drains queued and running tasks") {
+    au::thread_pool pool(3, 1000);
+    std::atomic<size_t> done(0);
+    for (size_t i = 0; i < 500; ++i) {
+        pool.post([&done] {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            ++done;
+        });
+    }
+    pool.wait_idle();
+    CHECK(done == 500);
+}
+
+TEST_CASE("strands run tasks of a key in order and one at a time") {
+    thread_pool pool(4, 100);
+    au::keyed_executor<size_t> executor(pool, 8);
+    const size_t keys = 16;
+    const size_t per_key = 2000;
+    std::vector<size_t> next(keys, 0);
+    std::vector<std::atomic<int>> running(keys);
+    std::atomic<size_t> misordered(0);
+    std::atomic<size_t> overlapping(0);
+
+    // one producer per key, several producers per strand
+    std::vector<std::thread> producers;
+    for (size_t producer = 0; producer < 4; ++producer) {
+        producers.emplace_back([&, producer] {
+            for (size_t i = 0; i < per_key; ++i) {
+                for (size_t key = producer; key < keys; key += 4) {
+                    executor.post(key, [&, key, i] {
+                        if (running[key].fetch_add(1) != 0) {
+                            ++overlapping;
+                        }
+                        if (next[key] != i) {
+                            ++misordered;
+                        }
+                        next[key] = i + 1;
+                        running[key].fetch_sub(1);
+                    });
+                }
+            }
+        });
+    }
+    for (auto &producer : producers) {
+        producer.join();
+    }
+    pool.wait_idle();
+    CHECK(misordered == 0);
+    CHECK(overlapping == 0);
+    CHECK(std::count(next.begin(), next.end(), per_key) == keys);
+
+    auto last = executor.submit(3, [&next] { return next[3]; });
+    CHECK(pool.get(last) == per_key);
+
+    std::atomic<size_t> caught(0);
+    pool.set_exception_handler([&caught](std::exception_ptr) { ++caught; });
+    au::strand serial(pool);
+    serial.post([] { throw std::runtime_error("strand"); });
+    // reported by the strand task itself, before the next task of the strand
+    pool.get(serial.submit([] {}));
+    CHECK(caught == 1);
+}
+
+TEST_CASE("a strand whose drain is refused discards its tasks and recovers") {
+    thread_pool pool(1, 1);
+    pool.set_backpressure(au::backpressure{au::overflow_policy::reject});
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    pool.post([opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+    });
+    blocked.get_future().wait();
+    auto queued = pool.submit([] { return 1; });
+
+    au::strand serial(pool);
+    auto refused = serial.submit([] { return 2; });
+    CHECK(refused.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    CHECK_THROWS_AS(refused.get(), std::future_error const &);
+
+    gate.set_value();
+    CHECK(queued.get() == 1);
+    CHECK(pool.get(serial.submit([] { return 3; })) == 3);
+}
+
+TEST_CASE("strand tasks dropped with their pool report broken_promise") {
+    std::unique_ptr<au::thread_pool> pool(new au::thread_pool(1, 16));
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    pool->post([opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+    });
+    blocked.get_future().wait();
+    au::strand serial(*pool);
+    auto first = serial.submit([] { return 1; });
+    auto second = serial.submit([] { return 2; });
+
+    // the worker finishes the gate task only once the pool is stopping
+    std::thread destroyer([&pool] {
+        pool.reset();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    gate.set_value();
+    destroyer.join();
+    CHECK_THROWS_AS(first.get(), std::future_error const &);
+    CHECK_THROWS_AS(second.get(), std::future_error const &);
+}
+
+TEST_CASE("cpu lists, NUMA nodes and pinned workers with node queues") {
+    CHECK(au::detail::parse_cpu_list("0-2,5,7-8\n") == std::vector<int>({0, 1, 2, 5, 7, 8}));
+    CHECK(au::detail::parse_cpu_list("").empty());
+    auto nodes = au::detail::numa_nodes();
+    REQUIRE(!nodes.empty());
+    REQUIRE(!nodes.front().empty());
+    int cpu = nodes.front().front();
+
+    // two nodes on one CPU, so that the node queues are used anywhere
+    thread_pool pool(3, 100);
+    au::affinity_options options;
+    options.mode = au::pinning::cores;
+    options.nodes = {{cpu}, {cpu}};
+    pool.set_affinity(options);
+    CHECK(pool.get_affinity().nodes.size() == 2);
+
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 1000; ++i) {
+        results.push_back(pool.submit([] { return au::detail::current_cpu(); }));
+    }
+    auto nested = pool.submit([&pool] {
+        std::vector<std::future<int>> inner;
+        for (int i = 0; i < 100; ++i) {
+            inner.push_back(pool.submit([i] { return i; }));
+        }
+        int sum = 0;
+        for (auto &item : inner) {
+            sum += pool.get(item);
+        }
+        return sum;
+    });
+    // the workers run on cpu, the main thread only waits here
+    size_t elsewhere = 0;
+    for (auto &result : results) {
+        int ran_on = result.get();
+        if (ran_on != cpu && ran_on != -1) {
+            ++elsewhere;
+        }
+    }
+    CHECK(elsewhere == 0);
+    CHECK(pool.get(nested) == 4950);
+
+    pool.set_threads_count(5);
+    options.mode = au::pinning::none;
+    pool.set_affinity(options);
+    pool.post_n(500, [](size_t) {});
+    pool.wait_idle();
+}
+
+TEST_CASE("spinning idle workers pick up tasks without being woken") {
+    thread_pool pool(4, 1000);
+    au::idle_strategy strategy;
+    strategy.spins = 2000;
+    strategy.yields = 50;
+    pool.set_idle_strategy(strategy);
+    CHECK(pool.get_idle_strategy().spins == 2000);
+    CHECK(pool.get_idle_strategy().yields == 50);
+
+    // bursts separated by pauses: workers go idle between them
+    std::atomic<size_t> done(0);
+    for (size_t burst = 0; burst < 200; ++burst) {
+        std::vector<std::future<void>> results;
+        for (size_t i = 0; i < 1 + burst % 7; ++i) {
+            results.push_back(pool.submit([&done] { ++done; }));
+        }
+        for (auto &result : results) {
+            result.get();
+        }
+        if (burst % 10 == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+    size_t expected = 0;
+    for (size_t burst = 0; burst < 200; ++burst) {
+        expected += 1 + burst % 7;
+    }
+    CHECK(done == expected);
+
+    auto nested = pool.submit([&pool] {
+        std::vector<std::future<size_t>> inner;
+        for (size_t i = 0; i < 100; ++i) {
+            inner.push_back(pool.submit([i] { return i; }));
+        }
+        size_t sum = 0;
+        for (auto &item : inner) {
+            sum += pool.get(item);
+        }
+        return sum;
+    });
+    CHECK(nested.get() == 4950);
+
+    pool.set_idle_strategy(au::idle_strategy{0, 0});
+    pool.post_n(100, [](size_t) {});
+    pool.wait_idle();
+}
+
+TEST_CASE("timer wheel expires timers at their tick") {
+    typedef std::chrono::steady_clock::time_point time_point;
+    typedef au::detail::timer_wheel<size_t> wheel_type;
+    std::chrono::milliseconds tick(1);
+    time_point origin = std::chrono::steady_clock::now();
+    wheel_type wheel(origin, tick);
+
+    std::minstd_rand random(7);
+    std::vector<time_point> dues;
+    for (size_t i = 0; i < 2000; ++i) {
+        // up to the third level, some between ticks
+        dues.push_back(origin + std::chrono::microseconds(random() % 300000000));
+        wheel.insert(origin, dues.back(), i);
+    }
+    std::vector<wheel_type::entry> expired;
+    size_t wrong = 0;
+    for (time_point now = origin; !wheel.empty(); now += tick) {
+        // sleeping until next_wakeup() would have missed nothing
+        bool asleep = wheel.next_wakeup() > now;
+        wheel.advance(now, expired);
+        if (asleep && !expired.empty()) {
+            ++wrong;
+        }
+        for (auto const &item : expired) {
+            if (dues[item.value_] > now || now - dues[item.value_] >= tick) {
+                ++wrong;
+            }
+        }
+        expired.clear();
+    }
+    CHECK(wrong == 0);
+
+    // beyond the last level
+    time_point now = origin + std::chrono::hours(1);
+    time_point far = now + std::chrono::hours(6);
+    wheel.insert(now, far, 0);
+    wheel.advance(far - tick, expired);
+    CHECK(expired.empty());
+    wheel.advance(far, expired);
+    CHECK(expired.size() == 1);
+}
+
+TEST_CASE("schedule_after runs tasks in due order, not before they are due") {
+    thread_pool pool(1, 100);
+    auto start = std::chrono::steady_clock::now();
+    std::mutex mutex;
+    std::vector<int> order;
+    auto record = [&mutex, &order](int value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(value);
+        return std::chrono::steady_clock::now();
+    };
+    auto third = pool.schedule_after(std::chrono::milliseconds(60), record, 3);
+    auto first = pool.schedule_after(std::chrono::milliseconds(20), record, 1);
+    auto second = pool.schedule_after(std::chrono::milliseconds(40), record, 2);
+    CHECK(pool.get(first) - start >= std::chrono::milliseconds(20));
+    CHECK(pool.get(second) - start >= std::chrono::milliseconds(40));
+    CHECK(pool.get(third) - start >= std::chrono::milliseconds(60));
+    CHECK(order == std::vector<int>({1, 2, 3}));
+
+    std::future<void> never;
+    {
+        thread_pool other(1, 100);
+        never = other.schedule_after(std::chrono::hours(1), [] {});
+    }
+    CHECK_THROWS_AS(never.get(), std::future_error const &);
+}
+
+TEST_CASE("schedule_every repeats until cancelled") {
+    thread_pool pool(2, 100);
+    au::cancellation_source source;
+    std::atomic<size_t> runs(0);
+    pool.schedule_every(std::chrono::milliseconds(2), source.token(), [&runs] {
+        ++runs;
+    });
+    auto limit = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (runs < 5 && std::chrono::steady_clock::now() < limit) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(runs >= 5);
+    source.cancel();
+    size_t stopped = runs;
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    CHECK(runs <= stopped + 1);
+    CHECK_THROWS_AS(pool.schedule_every(std::chrono::milliseconds(0), [] {}),
+                    std::invalid_argument const &);
+}
+
+#if AU_THREAD_POOL_COROUTINES
+au::task<int> square_on(thread_pool &pool, int value) {
+    co_await pool.schedule();
+    co_return value * value;
+}
+
+au::task<int> sum_of_squares(thread_pool &pool, int count) {
+    int sum = 0;
+    for (int i = 0; i < count; ++i) {
+        sum += co_await square_on(pool, i);
+    }
+    co_return sum;
+}
+
+au::task<int> after(thread_pool &pool, au::future<int> gate) {
+    co_await pool.schedule();
+    int value = co_await gate;
+    co_return value + 1;
+}
+
+au::task<void> fail_on(thread_pool &pool) {
+    co_await pool.schedule();
+    throw std::runtime_error("coroutine");
+}
+
+au::task<int> await_future(thread_pool &pool) {
+    int first = co_await au::spawn(pool, [] { return 20; });
+    int second = co_await au::spawn(pool, [] { return 22; });
+    co_return first + second;
+}
+
+// counts the frames of counted() alive
+struct frame_counter {
+    explicit frame_counter(std::atomic<int> &alive) : alive_(alive) {
+        ++alive_;
+    }
+
+    ~frame_counter() {
+        --alive_;
+    }
+
+    std::atomic<int> &alive_;
+};
+
+au::task<int> counted(thread_pool &pool, std::atomic<int> &alive, std::atomic_bool &started) {
+    frame_counter counter(alive);
+    started = true;
+    co_await pool.schedule();
+    co_return 1;
+}
+
+TEST_CASE("coroutines resume on the pool and nest") {
+    thread_pool pool(2, 5000);
+    std::vector<au::future<int>> results;
+    for (size_t i = 0; i < 1000; ++i) {
+        results.push_back(au::spawn(pool, sum_of_squares(pool, 10)));
+    }
+    for (auto const &result : results) {
+        CHECK(result.get() == 285);
+    }
+
+    // suspended coroutines hold no worker: far more of them than threads
+    std::promise<void> open;
+    std::shared_future<void> opened = open.get_future().share();
+    au::future<int> gate = au::spawn(pool, [opened] {
+        opened.wait();
+        return 1;
+    });
+    std::vector<au::future<int>> waiting;
+    for (size_t i = 0; i < 1000; ++i) {
+        waiting.push_back(au::spawn(pool, after(pool, gate)));
+    }
+    open.set_value();
+    for (auto const &result : waiting) {
+        CHECK(result.get() == 2);
+    }
+}
+
+TEST_CASE("coroutines pass exceptions and await futures") {
+    thread_pool pool(2, 100);
+    CHECK_THROWS_AS(au::spawn(pool, fail_on(pool)).get(), std::runtime_error const &);
+    CHECK(au::spawn(pool, await_future(pool)).get() == 42);
+}
+
+TEST_CASE("coroutines queued on a destroyed pool get broken_promise and are freed") {
+    std::unique_ptr<thread_pool> pool(new thread_pool(1, 16));
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::promise<void> blocked;
+    pool->post([opened, &blocked] {
+        blocked.set_value();
+        opened.wait();
+    });
+    blocked.get_future().wait();
+
+    std::atomic<int> alive(0);
+    std::atomic_bool started(false);
+    // suspended in co_await pool.schedule(), run up to it by this thread
+    auto suspended = au::spawn(*pool, counted(*pool, alive, started));
+    pool->help_until([&started] {
+        return started.load();
+    }, [](std::chrono::microseconds pause) {
+        std::this_thread::sleep_for(pause);
+    });
+    // never started
+    auto queued = au::spawn(*pool, counted(*pool, alive, started));
+    CHECK(alive == 1);
+
+    std::thread destroyer([&pool] {
+        pool.reset();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    gate.set_value();
+    destroyer.join();
+
+    CHECK_THROWS_AS(suspended.get(), std::future_error const &);
+    CHECK_THROWS_AS(queued.get(), std::future_error const &);
+    CHECK(alive == 0);
+}
+#endif
+
 // Примеры нетривиальных тестов:
 // - количество одновременно работающих задач == thread_cout
 // - во время set_thread_count возможно использование тредпула (задачи выполняются)
@@ -2,18 +2,151 @@
 
 #include <pthread.h>
 #include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
 #include <future>
-#include <queue>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 #include <iostream>
 #include <algorithm>
 
+#include "autoscale.hpp"
+#include "bounded_queue.hpp"
+#include "cancellation.hpp"
+#include "deadline_queue.hpp"
+#include "event_count.hpp"
+#include "task.hpp"
+#include "timer_wheel.hpp"
+#include "topology.hpp"
+#include "work_stealing_deque.hpp"
+
+// schedule() for C++20 coroutines, see coroutine.hpp
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define AU_THREAD_POOL_COROUTINES 1
+#endif
+#endif
+
 
 namespace au {
 
+    // latency critical requests, ordinary work, background batch jobs
+    enum class priority {
+        high, normal, low
+    };
+
+    // what happens to a task with a deadline that starts too late: it runs
+    // anyway, it runs and is counted in missed_deadlines(), or it does not
+    // run, is counted, and its future gets deadline_missed
+    enum class deadline_policy {
+        run, flag, drop
+    };
+
+    class deadline_missed : public std::runtime_error {
+    public:
+        deadline_missed() : std::runtime_error("deadline missed") {}
+    };
+
+    // What a thread outside the pool does when the lane it submits to is
+    // full: wait for room, wait at most timeout and then reject, throw
+    // queue_full, run the task itself, or discard the oldest queued task of
+    // the lane (its future reports broken_promise). Workers of the pool never
+    // wait, their tasks go to their own deques.
+    enum class overflow_policy {
+        block, block_for, reject, caller_runs, drop_oldest
+    };
+
+    struct backpressure {
+        overflow_policy policy = overflow_policy::block;
+        std::chrono::microseconds timeout{0};
+    };
+
+    // How an idle worker waits for work: it checks for tasks spins times
+    // with a pause instruction in between, then yields its CPU yields times,
+    // then parks. A task submitted meanwhile is picked up without a wake-up
+    // of a parked thread, at the price of CPU time. At most half of the
+    // workers spin at once; a producer wakes parked workers only for the
+    // tasks the spinning ones leave. Zero for both parks at once, the
+    // default on a single CPU.
+    struct idle_strategy {
+        unsigned spins = 100;
+        unsigned yields = 10;
+    };
+
+    class queue_full : public std::runtime_error {
+    public:
+        queue_full() : std::runtime_error("thread pool queue is full") {}
+    };
+
+    // Every worker owns a work stealing deque. Tasks submitted from a worker
+    // of the pool go to its own deque, tasks submitted from other threads go
+    // to a bounded lock-free shared queue, one per priority (lane). An idle
+    // worker picks the lane to serve by weighted round robin (high:normal:low
+    // = 4:2:1), so no lane starves; if that lane is empty it tries the others
+    // from high to low. The normal lane is the own deque, then the normal
+    // shared queue, then stealing from a randomly chosen worker. Idle workers
+    // spin a little (idle_strategy), then they park on an event count, as do
+    // producers blocked on a full queue; event counts are signalled only
+    // when someone actually waits. With workers pinned to
+    // more than one NUMA node (set_affinity), every node has its own normal
+    // shared queue, fed by the threads running on it, and a worker steals
+    // from its own node before the others.
+    class strand;
+
     class thread_pool {
     private:
-        typedef std::function<void()> type_function_;
+        typedef detail::task *task_;
+
+        static const size_t priority_count_ = 3;
+
+        // a retired worker leaves after its current task, its slot (and the
+        // tasks left in its deque) is taken over by the next started worker
+        struct worker {
+            detail::work_stealing_deque<task_> deque_;
+            std::thread thread_;
+            std::minstd_rand random_;
+            std::atomic_bool retire_{false};
+            std::atomic_bool finished_{false};
+            // written by the worker only, read by the autoscaling controller
+            std::atomic<uint64_t> executed_{0};
+            // set while the worker looks for or runs a task, for wait_idle
+            std::atomic_bool busy_{false};
+            // NUMA node it is pinned to, -1 if the pool uses no node queues
+            std::atomic<int> node_{-1};
+            unsigned turn_ = 0;
+        };
+
+        // immutable snapshot of the worker slots, thieves read it without
+        // locking; replaced (and the old one retired) when the pool grows
+        struct worker_array {
+            std::vector<worker *> items_;
+        };
+
+        // the same for the per node queues: every queue ever created stays
+        // in it, so nothing queued gets lost when the nodes change;
+        // cpu_node_[cpu] is the node whose queue a thread on cpu feeds, it
+        // is empty while the pool uses no node queues
+        struct node_array {
+            std::vector<detail::bounded_queue<task_> *> items_;
+            std::vector<int> cpu_node_;
+        };
     public:
+        typedef std::function<void(std::exception_ptr)> exception_handler;
+
+        typedef std::chrono::steady_clock::time_point time_point;
+
+        typedef std::chrono::steady_clock::duration duration;
+
         thread_pool() = delete;
 
         thread_pool(thread_pool const &) = delete;
@@ -29,155 +162,1413 @@ namespace au {
         ~thread_pool();
 
         template<class function, class... argument>
-        auto submit(function func, argument... args)
-        -> std::future<typename std::result_of<function(argument...)>::type>;
+        auto submit(function &&func, argument &&... args)
+        -> std::future<detail::result_of_t<function, argument...>>;
+
+        // tasks of other priorities submitted from a worker of the pool go to
+        // their lane while it has room, to the own deque otherwise
+        template<class function, class... argument>
+        auto submit(priority lane, function &&func, argument &&... args)
+        -> std::future<detail::result_of_t<function, argument...>>;
+
+        // rule replaces the backpressure of the pool for this call; when a
+        // batch is rejected, the tasks enqueued before stay queued
+        template<class function, class... argument>
+        auto submit(backpressure rule, function &&func, argument &&... args)
+        -> std::future<detail::result_of_t<function, argument...>>;
+
+        void set_backpressure(backpressure rule);
+
+        backpressure get_backpressure() const;
+
+        void set_idle_strategy(idle_strategy strategy);
+
+        idle_strategy get_idle_strategy() const;
+
+        // the task is skipped if token is cancelled before it starts, its
+        // future then gets task_cancelled; a producer finding the lane full
+        // first clears it of cancelled tasks, so they cause no backpressure
+        template<class function, class... argument>
+        auto submit(cancellation_token token, function &&func, argument &&... args)
+        -> std::future<detail::result_of_t<function, argument...>>;
+
+        // Tasks with a deadline are served earliest deadline first. One due
+        // within a millisecond (or overdue) goes before the priority lanes;
+        // later ones wait until the lanes are empty, so far deadlines do not
+        // starve plain tasks. deadline_policy decides about a task that starts
+        // after its deadline. The deadline queue is not bounded by
+        // max_queue_size, submitting to it never blocks.
+        template<class function, class... argument>
+        auto submit_with_deadline(time_point deadline, function &&func,
+                                  argument &&... args)
+        -> std::future<detail::result_of_t<function, argument...>>;
+
+        void set_deadline_policy(deadline_policy policy);
+
+        size_t missed_deadlines() const;
+
+        // Timers live in a hierarchical timer wheel with a 1 ms tick, kept by
+        // one timer thread started on first use; due timers are handed to
+        // the workers through the deadline queue, with the due time as the
+        // deadline. A timer never fires early, it is late by up to a tick
+        // plus the queueing delay. wait_idle() does not wait for timers, the
+        // destructor drops those not due yet (their futures get
+        // broken_promise).
+        template<class function, class... argument>
+        auto schedule_after(duration delay, function &&func, argument &&... args)
+        -> std::future<detail::result_of_t<function, argument...>>;
+
+        // func() runs every period: the next run is due a period after the
+        // previous one was due, at once if that passed meanwhile, so runs
+        // never overlap; an exception goes to the exception handler
+        template<class function>
+        void schedule_every(duration period, function &&func);
+
+        // stops once token is cancelled
+        template<class function>
+        void schedule_every(duration period, cancellation_token token, function &&func);
+
+        // runs func() without a future, an exception thrown by it goes to
+        // the exception handler of the pool
+        template<class function>
+        void post(function &&func);
+
+        template<class function>
+        void post(priority lane, function &&func);
+
+        // posts count tasks, the i-th one runs func(i)
+        template<class function>
+        void post_n(size_t count, function const &func);
+
+        // submits every callable of [first, last), the batch is enqueued
+        // with one reservation of the queue (or of the own deque, when called
+        // from a worker) and wakes no more workers than there are tasks
+        template<class iterator>
+        auto submit_bulk(iterator first, iterator last)
+        -> std::vector<std::future<detail::result_of_t<
+                typename std::iterator_traits<iterator>::value_type>>>;
+
+        // submits count tasks as one batch, the i-th one runs func(i)
+        template<class function>
+        auto submit_n(size_t count, function const &func)
+        -> std::vector<std::future<detail::result_of_t<function, size_t>>>;
+
+        // handler is called on the worker thread that caught the exception
+        // and must not throw; by default the exception is printed to std::cerr
+        void set_exception_handler(exception_handler handler);
+
+        // waits for a future of this pool and runs queued tasks of the pool
+        // meanwhile, so a task can wait for tasks it submitted without
+        // holding its worker: nested fork-join needs no extra threads
+        template<class result>
+        void wait(std::future<result> const &future);
+
+#ifdef AU_THREAD_POOL_COROUTINES
+        class schedule_awaitable;
+
+        // co_await pool.schedule() resumes the coroutine on a worker
+        schedule_awaitable schedule();
+#endif
+
+        // the loop behind wait: runs queued tasks of the pool until done()
+        // holds, sleep(pause) blocks at most pause when there is nothing to
+        // run and may return early when done() may have become true
+        template<class predicate, class sleeper>
+        void help_until(predicate const &done, sleeper const &sleep);
+
+        // returns once no task is queued or running (tasks submitted by
+        // other threads meanwhile are waited for too); from a task of the
+        // pool it waits for everything but the calling task
+        void wait_idle();
+
+        template<class result>
+        result get(std::future<result> &future);
+
+        template<class result>
+        result get(std::future<result> &&future);
 
         void set_threads_count(size_t threads_count);
 
+        // changes threads_count() by delta in one step under the resize
+        // lock, so concurrent calls add up (set_threads_count(threads_count()
+        // + delta) from several threads loses some of them); returns the new
+        // count
+        size_t add_threads(std::ptrdiff_t delta);
+
+        // the limit applies to every priority lane
         void set_max_queue_size(size_t max_queue_size);
 
         size_t threads_count() const;
 
         size_t max_queue_size() const;
 
+        // starts (or restarts with new options) a controller thread that
+        // adjusts threads_count() to the load, see autoscale_options;
+        // explicit set_threads_count calls still work and are corrected by
+        // the controller on its next period; calls must not overlap
+        void enable_autoscaling(autoscale_options const &options);
+
+        void disable_autoscaling();
+
+        // pins the running workers and those started later as options say;
+        // if the nodes are unknown or the system refuses, the workers stay
+        // where they are
+        void set_affinity(affinity_options const &options);
+
+        affinity_options get_affinity() const;
+
     private:
-        void init_thread(size_t begin, size_t end);
+        void add_workers(size_t count);
+
+        void retire_workers(size_t count);
 
         void stop();
 
-        void run_task();
+        void run_task(worker *self);
+
+        // a deadline task due within a millisecond
+        bool pop_urgent(task_ &current_task);
+
+        bool next_task(worker *self, task_ &current_task);
+
+        bool take_from(worker *self, priority lane, task_ &current_task);
+
+        bool pop_lane(priority lane, task_ &current_task);
+
+        static priority scheduled_lane(worker *self);
+
+        bool steal_task(worker *self, task_ &current_task);
+
+        bool steal_from(worker *self, worker_array *slots, int node, task_ &current_task);
+
+        bool pop_node(size_t node, task_ &current_task);
+
+        bool pop_nodes(int first, task_ &current_task);
+
+        detail::bounded_queue<task_> &shared_queue(priority lane);
+
+        void place_worker(size_t index, worker *slot);
+
+        bool run_pending();
+
+        bool spin_for_work(worker *self);
+
+        void wake_workers(size_t count);
+
+        template<class function, class... argument>
+        auto submit_to(priority lane, backpressure const *rule, function &&func,
+                       argument &&... args)
+        -> std::future<detail::result_of_t<function, argument...>>;
+
+        void push_task(task_ current_task, priority lane = priority::normal,
+                       backpressure const *rule = nullptr);
+
+        void push_tasks(task_ const *tasks, size_t count,
+                        priority lane = priority::normal,
+                        backpressure const *rule = nullptr);
+
+        size_t push_some(detail::bounded_queue<task_> &queue, task_ const *tasks,
+                         size_t count);
+
+        size_t overflow(detail::bounded_queue<task_> &queue, task_ const *tasks,
+                        size_t count, backpressure const &rule, time_point deadline);
+
+        static void discard_tasks(task_ const *tasks, size_t count);
+
+        size_t purge_cancelled();
+
+        template<class function>
+        void push_batch(size_t count, function make_task);
+
+        // strands run posted functions inside their own tasks and report
+        // what they throw here
+        friend class strand;
+
+        void handle_exception(std::exception_ptr error);
+
+        static void count_executed(worker *self);
+
+        uint64_t executed_count() const;
+
+        void control(autoscale_options options);
+
+        void add_timer(time_point due, task_ current_task);
+
+        void schedule_periodic(time_point due, duration period, cancellation_token token,
+                               std::shared_ptr<std::function<void()>> call);
+
+        void run_timers();
+
+        void stop_timers();
+
+        template<class function>
+        task_ make_posted(function &&func);
+
+        worker *current_worker() const;
+
+        static worker *&thread_worker();
+
+        static thread_pool *&thread_owner();
 
         std::atomic_bool stop_value_;
-        std::condition_variable_any condition_variable_;
-        std::recursive_mutex mutex_;
-        std::recursive_mutex mutex_join_;
+        mutable std::recursive_mutex mutex_join_;
+
+        std::unique_ptr<detail::bounded_queue<task_>> lanes_[priority_count_];
+        detail::deadline_queue<task_> deadlines_;
+        std::atomic<deadline_policy> deadline_policy_;
+        std::atomic<size_t> missed_deadlines_;
+        std::atomic<overflow_policy> overflow_policy_;
+        std::atomic<int64_t> overflow_timeout_;
+        std::atomic<uint64_t> purged_epoch_;
+        detail::event_count not_full_;
+        detail::event_count not_empty_;
+        std::atomic<unsigned> idle_spins_;
+        std::atomic<unsigned> idle_yields_;
+        std::atomic<size_t> spinning_;
+        std::atomic<int64_t> pending_;
+        std::atomic<int64_t> outside_busy_;
+        std::shared_ptr<exception_handler> handler_;
+
+        std::thread controller_;
+        std::mutex controller_mutex_;
+        std::condition_variable controller_wake_;
+        bool controller_stop_ = false;
+
+        detail::timer_wheel<task_> timers_;
+        std::thread timer_thread_;
+        std::mutex timer_mutex_;
+        std::condition_variable timer_wake_;
+        bool timer_stop_ = false;
+
+        std::vector<std::unique_ptr<worker>> workers_;
+        std::vector<std::unique_ptr<worker_array>> worker_arrays_;
+        std::atomic<worker_array *> active_workers_;
+
+        affinity_options affinity_;
+        std::vector<std::unique_ptr<detail::bounded_queue<task_>>> node_queues_;
+        std::vector<std::unique_ptr<node_array>> node_arrays_;
+        std::atomic<node_array *> active_nodes_;
+
+        std::atomic<size_t> size_thread_;
+        // set while set_threads_count starts or retires workers
+        std::atomic_bool resizing_{false};
+    };
 
-        std::queue<type_function_> queue_;
-        std::vector<std::thread> threads_;
+#ifdef AU_THREAD_POOL_COROUTINES
+    class thread_pool::schedule_awaitable {
+    public:
+        explicit schedule_awaitable(thread_pool &pool) : pool_(pool) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        // if the pool refuses the task (stopped, full under the reject
+        // policy) or drops it unrun, the coroutine resumes at once and the
+        // co_await throws std::future_error(broken_promise)
+        void await_suspend(std::coroutine_handle<> handle) {
+            try {
+                pool_.post(detail::on_discard([handle] {
+                    handle.resume();
+                }, [this, handle] {
+                    error_ = detail::broken_promise();
+                    handle.resume();
+                }));
+            } catch (...) {
+                // the coroutine was resumed by the fallback and may be gone
+                // with this awaitable
+            }
+        }
+
+        void await_resume() const {
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+        }
 
-        size_t limit_queue_;
-        size_t size_thread_;
+    private:
+        thread_pool &pool_;
+        std::exception_ptr error_;
     };
 
-    void thread_pool::init_thread(size_t begin, size_t end) {
-        for (size_t i = begin; i < end; ++i) {
-            threads_.push_back(std::thread(&thread_pool::run_task, this));
+    inline thread_pool::schedule_awaitable thread_pool::schedule() {
+        return schedule_awaitable(*this);
+    }
+#endif
+
+    inline thread_pool::worker *&thread_pool::thread_worker() {
+        static thread_local worker *current = nullptr;
+        return current;
+    }
+
+    inline thread_pool *&thread_pool::thread_owner() {
+        static thread_local thread_pool *owner = nullptr;
+        return owner;
+    }
+
+    inline thread_pool::worker *thread_pool::current_worker() const {
+        return thread_owner() == this ? thread_worker() : nullptr;
+    }
+
+    // slots of finished retired workers are reused first, the snapshot
+    // read by thieves is replaced only when new slots are appended
+    inline void thread_pool::add_workers(size_t count) {
+        std::vector<worker *> started;
+        for (auto &slot : workers_) {
+            if (started.size() == count) {
+                break;
+            }
+            if (slot->retire_ && slot->finished_) {
+                slot->thread_.join();
+                slot->retire_ = false;
+                slot->finished_ = false;
+                started.push_back(slot.get());
+            }
+        }
+        if (started.size() < count) {
+            std::unique_ptr<worker_array> slots(new worker_array);
+            while (started.size() < count) {
+                workers_.emplace_back(new worker);
+                workers_.back()->random_.seed(static_cast<unsigned>(workers_.size()));
+                started.push_back(workers_.back().get());
+            }
+            for (auto &item : workers_) {
+                slots->items_.push_back(item.get());
+            }
+            active_workers_.store(slots.get(), std::memory_order_release);
+            worker_arrays_.push_back(std::move(slots));
+        }
+        for (worker *slot : started) {
+            slot->thread_ = std::thread(&thread_pool::run_task, this, slot);
+        }
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            if (std::find(started.begin(), started.end(), workers_[i].get()) != started.end()) {
+                place_worker(i, workers_[i].get());
+            }
         }
     }
 
-    thread_pool::thread_pool(size_t threads_count, size_t max_queue_size) :
-            stop_value_(false), limit_queue_(max_queue_size),
-            size_thread_(threads_count) {
+    inline void thread_pool::retire_workers(size_t count) {
+        for (auto slot = workers_.rbegin(); slot != workers_.rend() && count > 0; ++slot) {
+            if ((*slot)->thread_.joinable() && !(*slot)->retire_) {
+                (*slot)->retire_ = true;
+                --count;
+            }
+        }
+        not_empty_.notify_all();
+    }
+
+    inline thread_pool::thread_pool(size_t threads_count, size_t max_queue_size) :
+            stop_value_(false), deadline_policy_(deadline_policy::run),
+            missed_deadlines_(0), overflow_policy_(overflow_policy::block),
+            overflow_timeout_(0), purged_epoch_(0), idle_spins_(0), idle_yields_(0), spinning_(0),
+            pending_(0), outside_busy_(0),
+            timers_(std::chrono::steady_clock::now(), std::chrono::milliseconds(1)),
+            active_workers_(nullptr), active_nodes_(nullptr), size_thread_(threads_count) {
         if (threads_count <= 0 || max_queue_size <= 0) {
             throw std::runtime_error("count < 0");
         }
-        init_thread(0, size_thread_);
-    }
-
-    void thread_pool::run_task() {
-        while (!stop_value_ &&
-               threads_.size() <= size_thread_) {
-            type_function_ current_task;
-            {
-                std::unique_lock<std::recursive_mutex> lock(mutex_);
-                condition_variable_.wait(lock,
-                                         [this] {
-                                             return !queue_.empty() ||
-                                                    stop_value_;
-                                         }
-                );
-                if (stop_value_ || queue_.empty()) {
-                    lock.unlock();
-                    return;
+        for (auto &lane : lanes_) {
+            lane.reset(new detail::bounded_queue<task_>(max_queue_size));
+        }
+        // spinning only delays the producer a worker waits for
+        if (detail::cpu_limit() > 1) {
+            set_idle_strategy(idle_strategy());
+        }
+        std::lock_guard<std::recursive_mutex> lock(mutex_join_);
+        add_workers(size_thread_);
+    }
+
+    // node < 0: from any worker
+    inline bool thread_pool::steal_from(worker *self, worker_array *slots, int node,
+                                        task_ &current_task) {
+        size_t count = slots->items_.size();
+        size_t start = self->random_() % count;
+        for (size_t i = 0; i < count; ++i) {
+            worker *victim = slots->items_[(start + i) % count];
+            if (victim == self ||
+                (node >= 0 && victim->node_.load(std::memory_order_relaxed) != node)) {
+                continue;
+            }
+            if (victim->deque_.steal(current_task)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the own node first: its tasks are the cheapest to move, then the
+    // queues of the other nodes, then any worker
+    inline bool thread_pool::steal_task(worker *self, task_ &current_task) {
+        worker_array *slots = active_workers_.load(std::memory_order_acquire);
+        int node = self->node_.load(std::memory_order_relaxed);
+        if (node >= 0 && steal_from(self, slots, node, current_task)) {
+            return true;
+        }
+        return pop_nodes(node, current_task) || steal_from(self, slots, -1, current_task);
+    }
+
+    inline bool thread_pool::pop_node(size_t node, task_ &current_task) {
+        node_array *nodes = active_nodes_.load(std::memory_order_acquire);
+        if (nodes == nullptr || node >= nodes->items_.size() ||
+            !nodes->items_[node]->try_pop(current_task)) {
+            return false;
+        }
+        not_full_.notify_all();
+        return true;
+    }
+
+    // every node queue, starting after first
+    inline bool thread_pool::pop_nodes(int first, task_ &current_task) {
+        node_array *nodes = active_nodes_.load(std::memory_order_acquire);
+        if (nodes == nullptr) {
+            return false;
+        }
+        size_t count = nodes->items_.size();
+        for (size_t i = 1; i <= count; ++i) {
+            if (pop_node((static_cast<size_t>(first + count) + i) % count, current_task)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the normal lane of a thread on a pinned node is the queue of the node
+    inline detail::bounded_queue<thread_pool::task_> &thread_pool::shared_queue(priority lane) {
+        if (lane == priority::normal) {
+            node_array *nodes = active_nodes_.load(std::memory_order_acquire);
+            if (nodes != nullptr && !nodes->cpu_node_.empty()) {
+                int cpu = detail::current_cpu();
+                if (cpu >= 0 && static_cast<size_t>(cpu) < nodes->cpu_node_.size() &&
+                    nodes->cpu_node_[cpu] >= 0) {
+                    return *nodes->items_[nodes->cpu_node_[cpu]];
+                }
+            }
+        }
+        return *lanes_[static_cast<size_t>(lane)];
+    }
+
+    inline priority thread_pool::scheduled_lane(worker *self) {
+        static const priority schedule[] = {
+                priority::high, priority::normal, priority::high, priority::low,
+                priority::high, priority::normal, priority::high
+        };
+        return schedule[self->turn_++ % (sizeof(schedule) / sizeof(schedule[0]))];
+    }
+
+    inline bool thread_pool::pop_lane(priority lane, task_ &current_task) {
+        if (lanes_[static_cast<size_t>(lane)]->try_pop(current_task)) {
+            // producers of every lane wait on the same event count
+            not_full_.notify_all();
+            return true;
+        }
+        return false;
+    }
+
+    inline bool thread_pool::take_from(worker *self, priority lane, task_ &current_task) {
+        if (lane != priority::normal) {
+            return pop_lane(lane, current_task);
+        }
+        int node = self->node_.load(std::memory_order_relaxed);
+        return self->deque_.pop(current_task) ||
+               (node >= 0 && pop_node(static_cast<size_t>(node), current_task)) ||
+               pop_lane(lane, current_task) ||
+               steal_task(self, current_task);
+    }
+
+    inline bool thread_pool::pop_urgent(task_ &current_task) {
+        return !deadlines_.empty() &&
+               deadlines_.try_pop_before(std::chrono::steady_clock::now() +
+                                         std::chrono::milliseconds(1), current_task);
+    }
+
+    inline bool thread_pool::next_task(worker *self, task_ &current_task) {
+        if (pop_urgent(current_task)) {
+            return true;
+        }
+        priority first = scheduled_lane(self);
+        if (take_from(self, first, current_task)) {
+            return true;
+        }
+        for (priority lane : {priority::high, priority::normal, priority::low}) {
+            if (lane != first && take_from(self, lane, current_task)) {
+                return true;
+            }
+        }
+        return deadlines_.try_pop(current_task);
+    }
+
+    inline void thread_pool::run_task(worker *self) {
+        thread_worker() = self;
+        thread_owner() = this;
+        while (!stop_value_ && !self->retire_) {
+            task_ current_task = nullptr;
+            self->busy_.store(true);
+            if (next_task(self, current_task)) {
+                pending_.fetch_sub(1);
+                current_task->run();
+                count_executed(self);
+                continue;
+            }
+            self->busy_.store(false);
+            if (spin_for_work(self)) {
+                continue;
+            }
+            auto key = not_empty_.prepare_wait();
+            if (pending_.load() > 0 || stop_value_ || self->retire_) {
+                not_empty_.cancel_wait();
+                continue;
+            }
+            not_empty_.wait(key);
+        }
+        // the others may all be parked, tasks left behind must not wait
+        // for the next submit
+        if (!self->deque_.empty()) {
+            not_empty_.notify_all();
+        }
+        self->busy_.store(false);
+        self->finished_ = true;
+    }
+
+    // the idle phase before parking, true once there may be work; a spinner
+    // that was counted on by producers and found work wakes a parked worker
+    // for the rest. Like parking, leaving the spin (spinning_ first, then
+    // pending_) pairs with wake_workers (pending_ first, then spinning_), so
+    // no task is left with every worker parked.
+    inline bool thread_pool::spin_for_work(worker *self) {
+        unsigned spins = idle_spins_.load(std::memory_order_relaxed);
+        unsigned yields = idle_yields_.load(std::memory_order_relaxed);
+        if (spins + yields == 0) {
+            return false;
+        }
+        if (2 * spinning_.fetch_add(1) >= size_thread_.load(std::memory_order_relaxed)) {
+            spinning_.fetch_sub(1);
+            return false;
+        }
+        bool found = false;
+        for (unsigned i = 0; i < spins + yields; ++i) {
+            if (pending_.load(std::memory_order_relaxed) > 0 || stop_value_ || self->retire_) {
+                found = true;
+                break;
+            }
+            if (i < spins) {
+                detail::cpu_relax();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        if (spinning_.fetch_sub(1) == 1 && found && pending_.load() > 1) {
+            not_empty_.notify_one();
+        }
+        return found;
+    }
+
+    // spinning workers take count tasks without being woken
+    inline void thread_pool::wake_workers(size_t count) {
+        size_t spinning = spinning_.load();
+        not_empty_.notify_n(count > spinning ? count - spinning : 0);
+    }
+
+    inline void thread_pool::set_idle_strategy(idle_strategy strategy) {
+        idle_spins_ = strategy.spins;
+        idle_yields_ = strategy.yields;
+    }
+
+    inline idle_strategy thread_pool::get_idle_strategy() const {
+        idle_strategy strategy;
+        strategy.spins = idle_spins_;
+        strategy.yields = idle_yields_;
+        return strategy;
+    }
+
+    // one task for a thread waiting on a future: a worker looks where it
+    // would look for work, other threads only take from the shared queue
+    inline bool thread_pool::run_pending() {
+        worker *self = current_worker();
+        task_ current_task = nullptr;
+        if (self != nullptr) {
+            if (!next_task(self, current_task)) {
+                return false;
+            }
+            pending_.fetch_sub(1);
+            current_task->run();
+            count_executed(self);
+            return true;
+        }
+        // counted before the pop, so that wait_idle never sees the task
+        // neither queued nor running
+        outside_busy_.fetch_add(1);
+        bool found = pop_urgent(current_task) ||
+                     pop_lane(priority::high, current_task) ||
+                     pop_lane(priority::normal, current_task) ||
+                     pop_nodes(-1, current_task) ||
+                     pop_lane(priority::low, current_task) ||
+                     deadlines_.try_pop(current_task);
+        if (found) {
+            pending_.fetch_sub(1);
+            current_task->run();
+        }
+        outside_busy_.fetch_sub(1);
+        return found;
+    }
+
+    inline void thread_pool::wait_idle() {
+        worker *self = current_worker();
+        help_until([this, self] {
+            if (pending_.load() > 0 || outside_busy_.load() > 0) {
+                return false;
+            }
+            worker_array *slots = active_workers_.load(std::memory_order_acquire);
+            for (worker *slot : slots->items_) {
+                if (slot != self && slot->busy_.load()) {
+                    return false;
                 }
-                current_task = std::move(queue_.front());
-                queue_.pop();
-                condition_variable_.notify_all();
             }
-            current_task();
+            return true;
+        }, [](std::chrono::microseconds pause) {
+            std::this_thread::sleep_for(pause);
+        });
+    }
+
+    template<class predicate, class sleeper>
+    void thread_pool::help_until(predicate const &done, sleeper const &sleep) {
+        // nothing to run: the awaited work is running somewhere, back off
+        // up to a millisecond between checks for new tasks
+        std::chrono::microseconds pause(1);
+        while (!done()) {
+            if (run_pending()) {
+                pause = std::chrono::microseconds(1);
+                continue;
+            }
+            sleep(pause);
+            pause = std::min<std::chrono::microseconds>(2 * pause,
+                                                        std::chrono::milliseconds(1));
         }
     }
 
+    template<class result>
+    void thread_pool::wait(std::future<result> const &future) {
+        help_until([&future] {
+            return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }, [&future](std::chrono::microseconds pause) {
+            future.wait_for(pause);
+        });
+    }
+
+    template<class result>
+    result thread_pool::get(std::future<result> &future) {
+        wait(future);
+        return future.get();
+    }
+
+    template<class result>
+    result thread_pool::get(std::future<result> &&future) {
+        return get(future);
+    }
+
+    inline void thread_pool::push_task(task_ current_task, priority lane,
+                                       backpressure const *rule) {
+        push_tasks(&current_task, 1, lane, rule);
+    }
+
+    inline void thread_pool::push_tasks(task_ const *tasks, size_t count,
+                                        priority lane, backpressure const *rule) {
+        worker *self = current_worker();
+        detail::bounded_queue<task_> &queue = self != nullptr
+                                              ? *lanes_[static_cast<size_t>(lane)]
+                                              : shared_queue(lane);
+        if (self != nullptr) {
+            pending_.fetch_add(static_cast<int64_t>(count));
+            // a worker must not block on a full lane
+            size_t pushed = lane == priority::normal ? 0 : queue.try_push_n(tasks, count);
+            for (size_t i = pushed; i < count; ++i) {
+                self->deque_.push(tasks[i]);
+            }
+            wake_workers(count);
+            return;
+        }
+
+        backpressure current = rule != nullptr ? *rule : get_backpressure();
+        time_point deadline = std::chrono::steady_clock::now() + current.timeout;
+        while (count > 0) {
+            size_t pushed = push_some(queue, tasks, count);
+            if (pushed == 0) {
+                pushed = overflow(queue, tasks, count, current, deadline);
+            }
+            tasks += pushed;
+            count -= pushed;
+        }
+    }
+
+    inline size_t thread_pool::push_some(detail::bounded_queue<task_> &queue,
+                                         task_ const *tasks, size_t count) {
+        pending_.fetch_add(static_cast<int64_t>(count));
+        size_t pushed = queue.try_push_n(tasks, count);
+        pending_.fetch_sub(static_cast<int64_t>(count - pushed));
+        wake_workers(pushed);
+        return pushed;
+    }
+
+    inline void thread_pool::discard_tasks(task_ const *tasks, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            tasks[i]->discard();
+        }
+    }
+
+    // handles a full lane once, returns how many of the tasks it consumed
+    // (pushed or run), the caller retries the rest
+    inline size_t thread_pool::overflow(detail::bounded_queue<task_> &queue,
+                                        task_ const *tasks, size_t count,
+                                        backpressure const &rule, time_point deadline) {
+        if (stop_value_) {
+            discard_tasks(tasks, count);
+            throw std::runtime_error("thread pool stoped");
+        }
+        // cancelled tasks give their slots back before anything else
+        if (purge_cancelled() > 0) {
+            return 0;
+        }
+        switch (rule.policy) {
+            case overflow_policy::reject:
+                discard_tasks(tasks, count);
+                throw queue_full();
+            case overflow_policy::caller_runs:
+                tasks[0]->run();
+                return 1;
+            case overflow_policy::drop_oldest: {
+                task_ oldest = nullptr;
+                if (queue.try_pop(oldest)) {
+                    pending_.fetch_sub(1);
+                    oldest->discard();
+                }
+                return 0;
+            }
+            case overflow_policy::block_for:
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    discard_tasks(tasks, count);
+                    throw queue_full();
+                }
+                break;
+            case overflow_policy::block:
+                break;
+        }
+
+        auto key = not_full_.prepare_wait();
+        if (stop_value_) {
+            not_full_.cancel_wait();
+            return 0;
+        }
+        size_t pushed = push_some(queue, tasks, count);
+        if (pushed != 0) {
+            not_full_.cancel_wait();
+            return pushed;
+        }
+        if (rule.policy == overflow_policy::block_for) {
+            not_full_.wait_until(key, deadline);
+        } else {
+            not_full_.wait(key);
+        }
+        return 0;
+    }
+
+    // Takes the cancelled tasks out of the queues submit(token) uses and
+    // completes their futures with task_cancelled. Scans only if a token was
+    // cancelled since the last purge; returns how many tasks were removed.
+    inline size_t thread_pool::purge_cancelled() {
+        uint64_t epoch = detail::cancellation_epoch().load();
+        if (purged_epoch_.exchange(epoch) == epoch) {
+            return 0;
+        }
+        auto cancelled = [](task_ current_task) {
+            return current_task->cancelled();
+        };
+        auto finish = [](task_ current_task) {
+            current_task->run();
+        };
+        size_t removed = lanes_[static_cast<size_t>(priority::normal)]->remove_if(cancelled, finish);
+        node_array *nodes = active_nodes_.load(std::memory_order_acquire);
+        if (nodes != nullptr) {
+            for (auto queue : nodes->items_) {
+                removed += queue->remove_if(cancelled, finish);
+            }
+        }
+        if (removed > 0) {
+            pending_.fetch_sub(static_cast<int64_t>(removed));
+            not_full_.notify_all();
+        }
+        return removed;
+    }
+
+    inline void thread_pool::set_backpressure(backpressure rule) {
+        overflow_timeout_ = rule.timeout.count();
+        overflow_policy_ = rule.policy;
+    }
+
+    inline backpressure thread_pool::get_backpressure() const {
+        backpressure rule;
+        rule.policy = overflow_policy_;
+        rule.timeout = std::chrono::microseconds(overflow_timeout_);
+        return rule;
+    }
+
+    template<class function>
+    void thread_pool::push_batch(size_t count, function make_task) {
+        std::vector<task_> tasks;
+        tasks.reserve(count);
+        try {
+            for (size_t i = 0; i < count; ++i) {
+                tasks.push_back(make_task(i));
+            }
+        } catch (...) {
+            for (task_ current_task : tasks) {
+                current_task->discard();
+            }
+            throw;
+        }
+        push_tasks(tasks.data(), tasks.size());
+    }
+
+    template<class function, class... argument>
+    auto thread_pool::submit(function &&func, argument &&... args)
+    -> std::future<detail::result_of_t<function, argument...>> {
+        return submit(priority::normal, std::forward<function>(func),
+                      std::forward<argument>(args)...);
+    }
+
+    template<class function, class... argument>
+    auto thread_pool::submit(priority lane, function &&func, argument &&... args)
+    -> std::future<detail::result_of_t<function, argument...>> {
+        return submit_to(lane, nullptr, std::forward<function>(func),
+                         std::forward<argument>(args)...);
+    }
+
+    template<class function, class... argument>
+    auto thread_pool::submit(backpressure rule, function &&func, argument &&... args)
+    -> std::future<detail::result_of_t<function, argument...>> {
+        return submit_to(priority::normal, &rule, std::forward<function>(func),
+                         std::forward<argument>(args)...);
+    }
+
+    template<class function, class... argument>
+    auto thread_pool::submit_to(priority lane, backpressure const *rule,
+                                function &&func, argument &&... args)
+    -> std::future<detail::result_of_t<function, argument...>> {
+
+        typedef detail::result_of_t<function, argument...> returt_type_;
+
+        if (stop_value_)
+            throw std::runtime_error("thread pool stoped");
+
+        std::promise<returt_type_> promise(std::allocator_arg,
+                                           detail::pool_allocator<returt_type_>());
+        std::future<returt_type_> result = promise.get_future();
+        push_task(detail::make_promise_task(std::move(promise),
+                                            std::forward<function>(func),
+                                            std::forward<argument>(args)...),
+                  lane, rule);
+        return result;
+    };
+
     template<class function, class... argument>
-    auto thread_pool::submit(function func, argument... args)
-    -> std::future<typename std::result_of<function(argument...)>::type> {
+    auto thread_pool::submit(cancellation_token token, function &&func, argument &&... args)
+    -> std::future<detail::result_of_t<function, argument...>> {
 
-        typedef typename std::result_of<function(
-                argument...)>::type returt_type_;
-        typedef std::packaged_task<returt_type_()> task;
+        typedef detail::result_of_t<function, argument...> returt_type_;
 
         if (stop_value_)
             throw std::runtime_error("thread pool stoped");
 
-        auto current_task = std::make_shared<task>(
-                std::bind(std::forward<function>(func),
-                          std::forward<argument>(args)...));
+        // a cancelled task keeps its queue slot until a worker pops it or a
+        // producer finds the lane full, either completes it unrun
+        std::promise<returt_type_> promise(std::allocator_arg,
+                                           detail::pool_allocator<returt_type_>());
+        std::future<returt_type_> result = promise.get_future();
+        push_task(detail::make_cancellable_task(std::move(token), std::move(promise),
+                                                std::forward<function>(func),
+                                                std::forward<argument>(args)...));
+        return result;
+    }
+
+    template<class function, class... argument>
+    auto thread_pool::submit_with_deadline(time_point deadline, function &&func,
+                                           argument &&... args)
+    -> std::future<detail::result_of_t<function, argument...>> {
 
-        std::future<returt_type_> result = current_task->get_future();
-        std::unique_lock<std::recursive_mutex> lock(mutex_);
-        condition_variable_.wait(lock, [this] {
-                    fprintf(stdout, "queue = %zu  limit = %zu \n", queue_.size(), limit_queue_);
-            return queue_.size() < limit_queue_;
+        typedef detail::result_of_t<function, argument...> returt_type_;
+
+        if (stop_value_)
+            throw std::runtime_error("thread pool stoped");
+
+        // the deadline is checked when the task starts, a dropped task
+        // reports deadline_missed through its future
+        auto checked = [this, deadline, call = std::forward<function>(func)](
+                auto &&... values) mutable -> returt_type_ {
+            deadline_policy policy = deadline_policy_.load();
+            if (policy != deadline_policy::run &&
+                std::chrono::steady_clock::now() > deadline) {
+                ++missed_deadlines_;
+                if (policy == deadline_policy::drop) {
+                    throw deadline_missed();
+                }
+            }
+            return detail::invoke(std::move(call),
+                                  std::forward<decltype(values)>(values)...);
+        };
+
+        std::promise<returt_type_> promise(std::allocator_arg,
+                                           detail::pool_allocator<returt_type_>());
+        std::future<returt_type_> result = promise.get_future();
+        task_ current_task = detail::make_promise_task(std::move(promise),
+                                                       std::move(checked),
+                                                       std::forward<argument>(args)...);
+        pending_.fetch_add(1);
+        deadlines_.push(deadline, current_task);
+        wake_workers(1);
+        return result;
+    }
+
+    inline void thread_pool::set_deadline_policy(deadline_policy policy) {
+        deadline_policy_ = policy;
+    }
+
+    inline size_t thread_pool::missed_deadlines() const {
+        return missed_deadlines_;
+    }
+
+    template<class function, class... argument>
+    auto thread_pool::schedule_after(duration delay, function &&func, argument &&... args)
+    -> std::future<detail::result_of_t<function, argument...>> {
+
+        typedef detail::result_of_t<function, argument...> returt_type_;
+
+        if (stop_value_)
+            throw std::runtime_error("thread pool stoped");
+
+        std::promise<returt_type_> promise(std::allocator_arg,
+                                           detail::pool_allocator<returt_type_>());
+        std::future<returt_type_> result = promise.get_future();
+        add_timer(std::chrono::steady_clock::now() + delay,
+                  detail::make_promise_task(std::move(promise),
+                                            std::forward<function>(func),
+                                            std::forward<argument>(args)...));
+        return result;
+    }
+
+    template<class function>
+    void thread_pool::schedule_every(duration period, function &&func) {
+        schedule_every(period, cancellation_token(), std::forward<function>(func));
+    }
+
+    template<class function>
+    void thread_pool::schedule_every(duration period, cancellation_token token,
+                                     function &&func) {
+        if (period <= duration::zero())
+            throw std::invalid_argument("schedule_every: period <= 0");
+        if (stop_value_)
+            throw std::runtime_error("thread pool stoped");
+
+        schedule_periodic(std::chrono::steady_clock::now() + period, period, token,
+                          std::make_shared<std::function<void()>>(
+                                  std::forward<function>(func)));
+    }
+
+    // every run is a new task, it puts the next one on the wheel when done
+    inline void thread_pool::schedule_periodic(time_point due, duration period,
+                                               cancellation_token token,
+                                               std::shared_ptr<std::function<void()>> call) {
+        add_timer(due, detail::task::make([this, due, period, token, call] {
+            if (token.cancelled()) {
+                return;
+            }
+            try {
+                (*call)();
+            } catch (...) {
+                handle_exception(std::current_exception());
+            }
+            if (!token.cancelled() && !stop_value_) {
+                schedule_periodic(std::max(due + period, std::chrono::steady_clock::now()),
+                                  period, token, call);
+            }
+        }));
+    }
+
+    // after stop_timers() the task is dropped
+    inline void thread_pool::add_timer(time_point due, task_ current_task) {
+        {
+            std::lock_guard<std::mutex> lock(timer_mutex_);
+            if (!timer_stop_) {
+                if (!timer_thread_.joinable()) {
+                    timer_thread_ = std::thread(&thread_pool::run_timers, this);
+                }
+                timers_.insert(std::chrono::steady_clock::now(), due, current_task);
+                current_task = nullptr;
+            }
+        }
+        if (current_task != nullptr) {
+            current_task->discard();
+            return;
+        }
+        timer_wake_.notify_one();
+    }
+
+    inline void thread_pool::run_timers() {
+        std::vector<detail::timer_wheel<task_>::entry> expired;
+        std::unique_lock<std::mutex> lock(timer_mutex_);
+        while (!timer_stop_) {
+            timers_.advance(std::chrono::steady_clock::now(), expired);
+            if (!expired.empty()) {
+                pending_.fetch_add(static_cast<int64_t>(expired.size()));
+                for (auto const &item : expired) {
+                    deadlines_.push(item.due_, item.value_);
+                }
+                wake_workers(expired.size());
+                expired.clear();
+            }
+            if (timers_.empty()) {
+                timer_wake_.wait(lock);
+            } else {
+                timer_wake_.wait_until(lock, timers_.next_wakeup());
+            }
+        }
+    }
+
+    inline void thread_pool::stop_timers() {
+        std::vector<detail::timer_wheel<task_>::entry> removed;
+        {
+            std::lock_guard<std::mutex> lock(timer_mutex_);
+            timer_stop_ = true;
+            timers_.clear(removed);
+        }
+        timer_wake_.notify_all();
+        if (timer_thread_.joinable()) {
+            timer_thread_.join();
+        }
+        for (auto const &item : removed) {
+            item.value_->discard();
+        }
+    }
+
+    template<class function>
+    thread_pool::task_ thread_pool::make_posted(function &&func) {
+        return detail::task::make([this, call = std::forward<function>(func)]() mutable {
+            try {
+                call();
+            } catch (...) {
+                handle_exception(std::current_exception());
+            }
         });
+    }
 
-        queue_.emplace([current_task]() {
-            (*current_task)();
+    template<class function>
+    void thread_pool::post(function &&func) {
+        post(priority::normal, std::forward<function>(func));
+    }
+
+    template<class function>
+    void thread_pool::post(priority lane, function &&func) {
+        if (stop_value_)
+            throw std::runtime_error("thread pool stoped");
+        push_task(make_posted(std::forward<function>(func)), lane);
+    }
+
+    template<class function>
+    void thread_pool::post_n(size_t count, function const &func) {
+        if (stop_value_)
+            throw std::runtime_error("thread pool stoped");
+        push_batch(count, [this, &func](size_t i) {
+            return make_posted([func, i]() mutable {
+                func(i);
+            });
+        });
+    }
+
+    template<class iterator>
+    auto thread_pool::submit_bulk(iterator first, iterator last)
+    -> std::vector<std::future<detail::result_of_t<
+            typename std::iterator_traits<iterator>::value_type>>> {
+
+        typedef detail::result_of_t<
+                typename std::iterator_traits<iterator>::value_type> returt_type_;
+
+        if (stop_value_)
+            throw std::runtime_error("thread pool stoped");
+
+        size_t count = static_cast<size_t>(std::distance(first, last));
+        std::vector<std::future<returt_type_>> result;
+        result.reserve(count);
+        push_batch(count, [&first, &result](size_t) {
+            std::promise<returt_type_> promise(std::allocator_arg,
+                                               detail::pool_allocator<returt_type_>());
+            result.push_back(promise.get_future());
+            return detail::make_promise_task(std::move(promise), *first++);
         });
-        condition_variable_.notify_one();
         return result;
-    };
+    }
+
+    template<class function>
+    auto thread_pool::submit_n(size_t count, function const &func)
+    -> std::vector<std::future<detail::result_of_t<function, size_t>>> {
+
+        typedef detail::result_of_t<function, size_t> returt_type_;
+
+        if (stop_value_)
+            throw std::runtime_error("thread pool stoped");
+
+        std::vector<std::future<returt_type_>> result;
+        result.reserve(count);
+        push_batch(count, [&func, &result](size_t i) {
+            std::promise<returt_type_> promise(std::allocator_arg,
+                                               detail::pool_allocator<returt_type_>());
+            result.push_back(promise.get_future());
+            return detail::make_promise_task(std::move(promise), func, i);
+        });
+        return result;
+    }
+
+    inline void thread_pool::set_exception_handler(exception_handler handler) {
+        std::atomic_store(&handler_, std::make_shared<exception_handler>(std::move(handler)));
+    }
 
-    size_t thread_pool::threads_count() const {
+    inline void thread_pool::handle_exception(std::exception_ptr error) {
+        std::shared_ptr<exception_handler> handler = std::atomic_load(&handler_);
+        if (handler && *handler) {
+            (*handler)(error);
+            return;
+        }
+        try {
+            std::rethrow_exception(error);
+        } catch (std::exception const &exception) {
+            std::cerr << "thread pool task failed: " << exception.what() << std::endl;
+        } catch (...) {
+            std::cerr << "thread pool task failed" << std::endl;
+        }
+    }
+
+    // waits for a resize in progress: tasks that grow their pool with
+    // set_threads_count(threads_count() + n) while it starts workers would
+    // all read the same count, and all but one increment would be lost
+    inline size_t thread_pool::threads_count() const {
+        while (resizing_) {
+            std::this_thread::yield();
+        }
         return size_thread_;
     }
 
-    void thread_pool::set_threads_count(size_t threads_count) {
-        {
-            std::unique_lock<std::recursive_mutex> lock(mutex_);
-            fprintf(stdout, "current thread size = %zu, set thread count %zu\n",
-                    size_thread_, threads_count);
-            if (threads_count <= 0)
-                throw std::runtime_error("count thread < 0");
+    inline void thread_pool::set_threads_count(size_t threads_count) {
+        std::lock_guard<std::recursive_mutex> lock_join(mutex_join_);
+        if (threads_count <= 0)
+            throw std::runtime_error("count thread < 0");
 
+        // no worker is joined here, so the pool keeps running tasks and a
+        // task may resize its own pool
+        resizing_ = true;
+        try {
             if (size_thread_ < threads_count) {
-                init_thread(size_thread_, threads_count);
-                size_thread_ = threads_count;
-                return;
+                add_workers(threads_count - size_thread_);
+            } else {
+                retire_workers(size_thread_ - threads_count);
             }
+        } catch (...) {
+            resizing_ = false;
+            throw;
         }
-        stop_value_ = true;
-        condition_variable_.notify_all();
-        for (auto &thread : threads_) {
-            fprintf(stdout, "wait join in set count \n");
-            thread.join();
-        }
-        threads_.clear();
-        stop_value_ = false;
         size_thread_ = threads_count;
-        init_thread(0, size_thread_);
+        resizing_ = false;
     }
 
-    size_t thread_pool::max_queue_size() const {
-        return limit_queue_;
+    inline size_t thread_pool::add_threads(std::ptrdiff_t delta) {
+        std::lock_guard<std::recursive_mutex> lock_join(mutex_join_);
+        std::ptrdiff_t threads_count = static_cast<std::ptrdiff_t>(size_thread_.load()) + delta;
+        if (threads_count <= 0)
+            throw std::runtime_error("count thread < 0");
+        set_threads_count(static_cast<size_t>(threads_count));
+        return static_cast<size_t>(threads_count);
     }
 
-    void thread_pool::set_max_queue_size(size_t max_queue_size) {
-        if (max_queue_size > 0)
-            limit_queue_ = max_queue_size;
-        else
+    inline size_t thread_pool::max_queue_size() const {
+        return lanes_[0]->limit();
+    }
+
+    inline void thread_pool::set_max_queue_size(size_t max_queue_size) {
+        if (max_queue_size > 0) {
+            std::lock_guard<std::recursive_mutex> lock(mutex_join_);
+            for (auto &lane : lanes_) {
+                lane->set_limit(max_queue_size);
+            }
+            for (auto &queue : node_queues_) {
+                queue->set_limit(max_queue_size);
+            }
+            not_full_.notify_all();
+        } else
             throw std::runtime_error("count queue < 0");
     }
 
-    void thread_pool::stop() {
-        std::lock_guard<std::recursive_mutex> lock(mutex_);
+    inline void thread_pool::stop() {
         stop_value_ = true;
     }
 
-    thread_pool::~thread_pool() {
+    inline void thread_pool::count_executed(worker *self) {
+        self->executed_.store(self->executed_.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+    }
+
+    inline uint64_t thread_pool::executed_count() const {
+        uint64_t count = 0;
+        for (worker *slot : active_workers_.load(std::memory_order_acquire)->items_) {
+            count += slot->executed_.load(std::memory_order_relaxed);
+        }
+        return count;
+    }
+
+    inline void thread_pool::enable_autoscaling(autoscale_options const &options) {
+        disable_autoscaling();
+        controller_stop_ = false;
+        controller_ = std::thread(&thread_pool::control, this, options);
+    }
+
+    inline void thread_pool::disable_autoscaling() {
+        {
+            std::lock_guard<std::mutex> lock(controller_mutex_);
+            controller_stop_ = true;
+        }
+        controller_wake_.notify_all();
+        if (controller_.joinable()) {
+            controller_.join();
+        }
+    }
+
+    inline void thread_pool::set_affinity(affinity_options const &options) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_join_);
+        affinity_.mode = options.mode;
+        affinity_.nodes = detail::usable_nodes(options.nodes.empty() ? detail::numa_nodes()
+                                                                     : options.nodes);
+
+        // node queues only pay off with more than one node
+        std::unique_ptr<node_array> nodes(new node_array);
+        if (affinity_.mode != pinning::none && affinity_.nodes.size() > 1) {
+            while (node_queues_.size() < affinity_.nodes.size()) {
+                node_queues_.emplace_back(new detail::bounded_queue<task_>(max_queue_size()));
+            }
+            for (size_t node = 0; node < affinity_.nodes.size(); ++node) {
+                for (int cpu : affinity_.nodes[node]) {
+                    if (nodes->cpu_node_.size() <= static_cast<size_t>(cpu)) {
+                        nodes->cpu_node_.resize(static_cast<size_t>(cpu) + 1, -1);
+                    }
+                    if (nodes->cpu_node_[cpu] < 0) {
+                        nodes->cpu_node_[cpu] = static_cast<int>(node);
+                    }
+                }
+            }
+        }
+        for (auto &queue : node_queues_) {
+            nodes->items_.push_back(queue.get());
+        }
+        active_nodes_.store(nodes.get(), std::memory_order_release);
+        node_arrays_.push_back(std::move(nodes));
+
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            if (workers_[i]->thread_.joinable() && !workers_[i]->retire_) {
+                place_worker(i, workers_[i].get());
+            }
+        }
+    }
+
+    inline affinity_options thread_pool::get_affinity() const {
+        std::lock_guard<std::recursive_mutex> lock(mutex_join_);
+        return affinity_;
+    }
+
+    // under mutex_join_
+    inline void thread_pool::place_worker(size_t index, worker *slot) {
+        if (affinity_.nodes.empty()) {
+            return;
+        }
+        std::vector<int> cpus;
+        std::vector<size_t> cpu_nodes;
+        for (size_t node = 0; node < affinity_.nodes.size(); ++node) {
+            for (int cpu : affinity_.nodes[node]) {
+                cpus.push_back(cpu);
+                cpu_nodes.push_back(node);
+            }
+        }
+        size_t position = index % cpus.size();
+        size_t node = cpu_nodes[position];
+        switch (affinity_.mode) {
+            case pinning::none:
+                detail::pin_thread(slot->thread_.native_handle(), cpus);
+                break;
+            case pinning::cores:
+                detail::pin_thread(slot->thread_.native_handle(), {cpus[position]});
+                break;
+            case pinning::nodes:
+                detail::pin_thread(slot->thread_.native_handle(), affinity_.nodes[node]);
+                break;
+        }
+        bool node_queues = affinity_.mode != pinning::none && affinity_.nodes.size() > 1;
+        slot->node_.store(node_queues ? static_cast<int>(node) : -1,
+                          std::memory_order_relaxed);
+    }
+
+    inline void thread_pool::control(autoscale_options options) {
+        size_t cpus = detail::cpu_limit();
+        double period_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                options.period).count();
+        detail::load_estimate load;
+        uint64_t executed = executed_count();
+        std::unique_lock<std::mutex> lock(controller_mutex_);
+        while (!controller_wake_.wait_for(lock, options.period,
+                                          [this] { return controller_stop_; })) {
+            uint64_t now = executed_count();
+            double throughput = static_cast<double>(now - executed) / period_us;
+            executed = now;
+
+            size_t threads = threads_count();
+            size_t parked = std::min(threads, not_empty_.waiters());
+            double utilization = 1.0 - static_cast<double>(parked) / threads;
+            double backlog = static_cast<double>(std::max<int64_t>(0, pending_.load()));
+            // nothing finished in the period: the backlog waited all of it
+            double delay = backlog == 0 ? 0
+                                        : throughput > 0 ? backlog / throughput
+                                                         : period_us;
+            load.update(options, utilization, delay);
+
+            size_t target = detail::autoscale_target(options, cpus, threads, load);
+            if (target != threads) {
+                set_threads_count(target);
+            }
+        }
+    }
+
+    inline thread_pool::~thread_pool() {
+        disable_autoscaling();
+        stop_timers();
         stop();
-        condition_variable_.notify_all();
-        for (auto &thread : threads_) {
-            thread.join();
+        not_full_.notify_all();
+        not_empty_.notify_all();
+        std::lock_guard<std::recursive_mutex> lock_join(mutex_join_);
+        for (auto &slot : workers_) {
+            if (slot->thread_.joinable()) {
+                slot->thread_.join();
+            }
+        }
+        task_ current_task = nullptr;
+        for (auto &slot : workers_) {
+            while (slot->deque_.pop(current_task)) {
+                current_task->discard();
+            }
+        }
+        for (auto &lane : lanes_) {
+            while (lane->try_pop(current_task)) {
+                current_task->discard();
+            }
+        }
+        for (auto &queue : node_queues_) {
+            while (queue->try_pop(current_task)) {
+                current_task->discard();
+            }
+        }
+        while (deadlines_.try_pop(current_task)) {
+            current_task->discard();
         }
     }
 }
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace au {
+namespace detail {
+
+    // Hierarchical timer wheel (Varghese and Lauck): levels_ wheels of 64
+    // slots, a slot of level l spans 64^l ticks. Inserting a timer and
+    // expiring it cost O(1); on its way a timer moves down at most
+    // levels_ - 1 times, when the slot it waits in turns. Timers further than
+    // 64^levels_ ticks away wait in the last level and are placed again when
+    // it turns. A timer expires at the first advance() to a tick not before
+    // its due time, never earlier. Not synchronized.
+    template<class type>
+    class timer_wheel {
+    public:
+        typedef std::chrono::steady_clock::time_point time_point;
+        typedef std::chrono::steady_clock::duration duration;
+
+        struct entry {
+            time_point due_;
+            type value_;
+        };
+
+        timer_wheel(time_point origin, duration tick) :
+                origin_(origin), tick_(tick), current_(0), size_(0),
+                slots_(levels_ * slot_count_) {}
+
+        size_t size() const {
+            return size_;
+        }
+
+        bool empty() const {
+            return size_ == 0;
+        }
+
+        void insert(time_point now, time_point due, type const &value) {
+            // nothing to expire before now: skip the idle ticks
+            if (size_ == 0) {
+                current_ = std::max(current_, tick_of(now));
+            }
+            place(entry{due, value});
+            ++size_;
+        }
+
+        // appends the timers due up to now to expired
+        void advance(time_point now, std::vector<entry> &expired) {
+            uint64_t target = tick_of(now);
+            while (current_ <= target && size_ > 0) {
+                process(expired);
+                ++current_;
+            }
+            if (size_ == 0) {
+                current_ = std::max(current_, target + 1);
+            }
+        }
+
+        // when advance() has something to do next: the next expiring slot of
+        // the first level or the next turn of a higher level; time_point::max()
+        // if there are no timers
+        time_point next_wakeup() const {
+            if (size_ == 0) {
+                return time_point::max();
+            }
+            uint64_t tick = current_;
+            while ((tick & mask_) != 0 && slots_[tick & mask_].empty()) {
+                ++tick;
+            }
+            return origin_ + tick_ * static_cast<int64_t>(tick);
+        }
+
+        // removes every timer, for the owner to dispose of
+        void clear(std::vector<entry> &removed) {
+            for (auto &items : slots_) {
+                removed.insert(removed.end(), items.begin(), items.end());
+                items.clear();
+            }
+            size_ = 0;
+        }
+
+    private:
+        static const unsigned bits_ = 6;
+        static const uint64_t slot_count_ = uint64_t(1) << bits_;
+        static const uint64_t mask_ = slot_count_ - 1;
+        static const unsigned levels_ = 4;
+
+        // the first tick at or after time
+        uint64_t expiry_of(time_point time) const {
+            if (time <= origin_) {
+                return 0;
+            }
+            return static_cast<uint64_t>((time - origin_ + tick_ - duration(1)) / tick_);
+        }
+
+        // the last tick at or before time
+        uint64_t tick_of(time_point time) const {
+            if (time <= origin_) {
+                return 0;
+            }
+            return static_cast<uint64_t>((time - origin_) / tick_);
+        }
+
+        std::vector<entry> &slot(unsigned level, uint64_t tick) {
+            return slots_[level * slot_count_ + ((tick >> (bits_ * level)) & mask_)];
+        }
+
+        void place(entry const &item) {
+            uint64_t expiry = std::max(expiry_of(item.due_), current_);
+            uint64_t delta = expiry - current_;
+            unsigned level = 0;
+            while (level + 1 < levels_ && delta >= (uint64_t(1) << (bits_ * (level + 1)))) {
+                ++level;
+            }
+            uint64_t range = uint64_t(1) << (bits_ * levels_);
+            if (delta >= range) {
+                expiry = current_ + range - 1;
+            }
+            slot(level, expiry).push_back(item);
+        }
+
+        // expires the tick current_; the higher levels turning at it are
+        // moved down first, from the highest, so that what they hold for
+        // this tick is expired at once
+        void process(std::vector<entry> &expired) {
+            unsigned turning = 0;
+            while (turning + 1 < levels_ &&
+                   (current_ & ((uint64_t(1) << (bits_ * (turning + 1))) - 1)) == 0) {
+                ++turning;
+            }
+            for (unsigned level = turning; level > 0; --level) {
+                std::vector<entry> moved;
+                moved.swap(slot(level, current_));
+                for (auto const &item : moved) {
+                    place(item);
+                }
+            }
+            std::vector<entry> due;
+            due.swap(slot(0, current_));
+            for (auto const &item : due) {
+                if (expiry_of(item.due_) <= current_) {
+                    expired.push_back(item);
+                    --size_;
+                } else {
+                    place(item);
+                }
+            }
+        }
+
+        time_point origin_;
+        duration tick_;
+        uint64_t current_;
+        size_t size_;
+        std::vector<std::vector<entry>> slots_;
+    };
+}
+// namespace detail
+}
+// namespace au
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace au {
+
+    // where the workers may run: anywhere, each on one CPU, or each on the
+    // CPUs of one NUMA node
+    enum class pinning {
+        none, cores, nodes
+    };
+
+    // Worker placement, see thread_pool::set_affinity. The CPUs of all nodes
+    // are numbered one node after the other and the i-th worker gets the
+    // i-th of them (round robin): with pinning::cores it runs on that CPU,
+    // with pinning::nodes on any CPU of its node. CPUs the process may not
+    // use are left out.
+    struct affinity_options {
+        pinning mode = pinning::none;
+        // CPUs of every NUMA node; empty: read from /sys/devices/system/node
+        std::vector<std::vector<int>> nodes;
+    };
+
+namespace detail {
+
+    // "0-3,8,10-11" as in sysfs cpulist files
+    inline std::vector<int> parse_cpu_list(std::string const &text) {
+        std::vector<int> cpus;
+        std::stringstream stream(text);
+        std::string range;
+        while (std::getline(stream, range, ',')) {
+            range.erase(std::remove_if(range.begin(), range.end(), [](char c) {
+                return c == ' ' || c == '\n';
+            }), range.end());
+            if (range.empty()) {
+                continue;
+            }
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    // CPUs the process may run on
+    inline std::vector<int> allowed_cpus() {
+        std::vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+#endif
+        if (cpus.empty()) {
+            for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {
+                cpus.push_back(static_cast<int>(cpu));
+            }
+        }
+        return cpus;
+    }
+
+    // drops the CPUs the process may not use and the nodes left empty
+    inline std::vector<std::vector<int>> usable_nodes(std::vector<std::vector<int>> nodes) {
+        std::vector<int> allowed = allowed_cpus();
+        std::vector<std::vector<int>> usable;
+        for (auto &node : nodes) {
+            node.erase(std::remove_if(node.begin(), node.end(), [&allowed](int cpu) {
+                return std::find(allowed.begin(), allowed.end(), cpu) == allowed.end();
+            }), node.end());
+            if (!node.empty()) {
+                usable.push_back(node);
+            }
+        }
+        if (usable.empty()) {
+            usable.push_back(allowed);
+        }
+        return usable;
+    }
+
+    // NUMA nodes from sysfs; one node with every allowed CPU where there is
+    // no such information
+    inline std::vector<std::vector<int>> numa_nodes() {
+        std::vector<std::vector<int>> nodes;
+        for (int node = 0;; ++node) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+                               "/cpulist");
+            if (!file) {
+                break;
+            }
+            std::string text;
+            std::getline(file, text);
+            nodes.push_back(parse_cpu_list(text));
+        }
+        return usable_nodes(nodes);
+    }
+
+    // false if the system refused or cannot pin threads
+    inline bool pin_thread(std::thread::native_handle_type handle,
+                           std::vector<int> const &cpus) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        return pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+#else
+        (void) handle;
+        (void) cpus;
+        return false;
+#endif
+    }
+
+    // CPU the calling thread runs on, -1 if unknown
+    inline int current_cpu() {
+#ifdef __linux__
+        return sched_getcpu();
+#else
+        return -1;
+#endif
+    }
+}
+// namespace detail
+}
+// namespace au
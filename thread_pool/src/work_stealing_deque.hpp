@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+namespace au {
+namespace detail {
+
+    // Chase-Lev work stealing deque, memory orders follow
+    // "Correct and Efficient Work-Stealing for Weak Memory Models"
+    // (Le, Pop, Cohen, Zappa Nardelli, 2013).
+    // The owner thread pushes and pops at the bottom (LIFO), any other
+    // thread steals from the top (FIFO). The buffer grows on demand, retired
+    // buffers are kept until destruction because thieves may still read them.
+    // type must be trivially copyable (the pool stores task pointers).
+    template<class type>
+    class work_stealing_deque {
+    public:
+        explicit work_stealing_deque(size_t capacity = 64);
+
+        work_stealing_deque(work_stealing_deque const &) = delete;
+
+        work_stealing_deque &operator=(work_stealing_deque const &) = delete;
+
+        void push(type value);
+
+        bool pop(type &value);
+
+        bool steal(type &value);
+
+        bool empty() const;
+
+    private:
+        struct buffer {
+            explicit buffer(size_t capacity) :
+                    mask(capacity - 1), items(new std::atomic<type>[capacity]) {}
+
+            size_t capacity() const {
+                return mask + 1;
+            }
+
+            type get(int64_t index) const {
+                return items[static_cast<size_t>(index) & mask]
+                        .load(std::memory_order_relaxed);
+            }
+
+            void put(int64_t index, type value) {
+                items[static_cast<size_t>(index) & mask]
+                        .store(value, std::memory_order_relaxed);
+            }
+
+            size_t mask;
+            std::unique_ptr<std::atomic<type>[]> items;
+        };
+
+        buffer *grow(buffer *old, int64_t top, int64_t bottom);
+
+        std::atomic<int64_t> top_;
+        std::atomic<int64_t> bottom_;
+        std::atomic<buffer *> buffer_;
+        std::vector<std::unique_ptr<buffer>> buffers_;
+    };
+
+    template<class type>
+    work_stealing_deque<type>::work_stealing_deque(size_t capacity) :
+            top_(0), bottom_(0) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        buffers_.emplace_back(new buffer(size));
+        buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+    }
+
+    template<class type>
+    typename work_stealing_deque<type>::buffer *
+    work_stealing_deque<type>::grow(buffer *old, int64_t top, int64_t bottom) {
+        buffers_.emplace_back(new buffer(old->capacity() * 2));
+        buffer *result = buffers_.back().get();
+        for (int64_t i = top; i < bottom; ++i) {
+            result->put(i, old->get(i));
+        }
+        buffer_.store(result, std::memory_order_release);
+        return result;
+    }
+
+    template<class type>
+    void work_stealing_deque<type>::push(type value) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        int64_t top = top_.load(std::memory_order_acquire);
+        buffer *items = buffer_.load(std::memory_order_relaxed);
+        if (bottom - top > static_cast<int64_t>(items->capacity()) - 1) {
+            items = grow(items, top, bottom);
+        }
+        items->put(bottom, value);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    template<class type>
+    bool work_stealing_deque<type>::pop(type &value) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        buffer *items = buffer_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+        value = items->get(bottom);
+        if (top != bottom) {
+            return true;
+        }
+        // last element, race with thieves for it
+        bool won = top_.compare_exchange_strong(top, top + 1,
+                                                std::memory_order_seq_cst,
+                                                std::memory_order_relaxed);
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+        return won;
+    }
+
+    template<class type>
+    bool work_stealing_deque<type>::steal(type &value) {
+        int64_t top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = bottom_.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return false;
+        }
+        buffer *items = buffer_.load(std::memory_order_acquire);
+        value = items->get(top);
+        return top_.compare_exchange_strong(top, top + 1,
+                                            std::memory_order_seq_cst,
+                                            std::memory_order_relaxed);
+    }
+
+    template<class type>
+    bool work_stealing_deque<type>::empty() const {
+        int64_t top = top_.load(std::memory_order_acquire);
+        int64_t bottom = bottom_.load(std::memory_order_acquire);
+        return top >= bottom;
+    }
+}
+// namespace detail
+}
+// namespace au